@@ -6,17 +6,27 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <math.h>
 #include <unistd.h>
+#define LOG_MODULE          "APP"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_APP
 #include "sys/log.h"
 #include "sys/ringbuffer.h"
+#include "sys/spool.h"
+#include "sys/tsdb.h"
+#include "sys/payload.h"
+#include "sys/evloop.h"
 #include "device_setup.h"
 #include "src/drivers/uart.h"
 #include "src/dust_sensor/dust_sensor.h"
 #include "src/gps/gps.h"
 #include "sys/json.h"
 #include "src/sim/at.h"
+#include "src/sim/sim.h"
 #include "transport/mqtt.h"
 #include "transport/http.h"
+#include "transport/ppp.h"
 #include "transport/transport_config.h"
 #include "fsm/fsm.h"
 
@@ -37,34 +47,43 @@ extern pm25_aqi_ctx_t dust;
 /* GPS data */
 extern gps_ctx_t gps;
 
-/* json ring buffer */
-ring_buffer_t json_ring_buf;
+/* json ring buffer, dataHandlerTask -> send2WebTask (lock-free SPSC) */
+ring_buffer_spsc_t json_ring_buf;
 char json_ring_buf_data[RING_BUFFER_SIZE];
-bool jsonReady = false;
-pthread_cond_t jsonCond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t jsonLock = PTHREAD_MUTEX_INITIALIZER;
 
-void* updateDustDataTask(void* arg)
+/* store-and-forward spool, dataHandlerTask -> send2WebTask during outages */
+spool_t spool;
+
+/* full-rate record of every sample, written by dataHandlerTask only;
+   storeLock keeps deviceShutdown() from closing it under an append */
+tsdb_t flightStore;
+static pthread_mutex_t storeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* one I/O thread owns the dust, GPS and SIM UARTs and the timers */
+evloop_t ioLoop;
+static timer_entry_t gpsPublishTimer;
+
+/* a complete dust frame paces the samples; skipped while the last one is handled */
+static void dustFrameReady(void* arg)
 {
-	while (1) {
-        sem_wait(&dustDataDoneSem);
-        getDustData();
-        sem_post(&dustDataReadySem);
-	}
+    (void) arg;
+    if (sem_trywait(&dustDataDoneSem) != 0)
+        return;
 
-	return arg;
+    getDustData();
+    sem_post(&dustDataReadySem);
 }
 
-void* updateGPSTask(void* arg)
+/* hand the latest fix to the data handler once per period */
+static void gpsPublishCb(void* arg)
 {
-	while (1) {
-        sem_wait(&gpsDataDoneSem);
-        gpsReadMavlink();
+    (void) arg;
+    if (sem_trywait(&gpsDataDoneSem) == 0) {
+        gpsPublish();
         sem_post(&gpsDataReadySem);
-        sleep(1);
-	}
+    }
 
-	return arg;
+    evloopArm(&ioLoop, &gpsPublishTimer, GPS_PUBLISH_MS, gpsPublishCb, NULL);
 }
 
 void* send2WebTask(void* arg)
@@ -86,34 +105,93 @@ void* dataHandlerTask(void* arg)
         double lat = gps.lat;
         double lon = gps.lon;
         double alt = gps.alt;
+        uint8_t fixType = gps.fixType;
+        uint8_t satellites = gps.satellites;
         sem_post(&gpsDataDoneSem);
 #else
         sleep(1);
         double lat = DEFAULT_LATITUDE;
         double lon = DEFAULT_LONGITUDE;
         double alt = DEFAULT_ALTITUDE;
+        uint8_t fixType = 0;
+        uint8_t satellites = 0;
 #endif
 
 #if DUST_SENSOR_ENABLE
         sem_wait(&dustDataReadySem);        
         float aqi = dust.aqi;
         uint32_t pm25 = dust.pm25;
+        uint16_t pm1 = dust.pm1;
+        uint16_t pm10 = dust.pm10;
         sem_post(&dustDataDoneSem);
 #else
         float aqi = 0;
         float pm25 = 0;
+        uint16_t pm1 = 0;
+        uint16_t pm10 = 0;
+#endif
+
+        bool hovering = isDroneHovering();
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+#if TSDB_ENABLE
+        tsdb_record_t sample = {
+            .timeUs = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+            .lat = (int32_t) lrint(lat * 1e7),
+            .lon = (int32_t) lrint(lon * 1e7),
+            .altMm = (int32_t) lrint(alt * 1000),
+            .pm1 = pm1,
+            .pm25 = pm25,
+            .pm10 = pm10,
+            .aqi10 = payloadAqi10(aqi),
+            .fixType = fixType,
+            .satellites = satellites,
+            .flags = hovering ? TSDB_FLAG_HOVER : 0
+        };
+        pthread_mutex_lock(&storeLock);
+        tsdbAppend(&flightStore, &sample);
+        pthread_mutex_unlock(&storeLock);
 #endif
 
-        if (!isDroneHovering())
+        if (!hovering)
+            continue;
+
+        LOG_DBG("Drone is hovering");
+        char rec[JSON_RECORD_MAX_LEN] = {0};
+#if PAYLOAD_BINARY_ENABLE
+        payload_sample_t record = {
+            .time = ts.tv_sec,
+            .lat = lat,
+            .lon = lon,
+            .alt = alt,
+            .pm25 = pm25,
+            .aqi = aqi
+        };
+        size_t len = payloadEncode((uint8_t*) rec, sizeof(rec), &record);
+#else
+        size_t len = formatJsonData(rec, sizeof(rec), lat, lon, alt, pm25, aqi);
+#endif
+        if (len == 0) {
+            LOG_ERR("Failed to format JSON data");
+            continue;
+        }
+
+        int spooled = spoolDivert(&spool, !fsmTransportReady(), rec, len);
+        if (spooled > 0) {
+            LOG_INF("Transport not ready - JSON data spooled");
             continue;
+        }
 
-        LOG_INF("Drone is hovering");
-        pthread_mutex_lock(&jsonLock);
-        parseAllDataToJson(&json_ring_buf, lat, lon, alt, pm25, aqi);
-        jsonReady = true;
+        int dropped = ring_buffer_push_record(&json_ring_buf, rec, len);
+        if (dropped < 0) {
+            LOG_ERR("Failed to push JSON data");
+            continue;
+        }
+
+        if (dropped > 0)
+            LOG_WRN("JSON ring buffer full - dropped %d oldest record(s)", dropped);
         LOG_INF("New JSON data has been pushed");
-        pthread_mutex_unlock(&jsonLock);
-        pthread_cond_signal(&jsonCond);
 	}
 
 	return arg;
@@ -133,14 +211,7 @@ static int setupDustSensor(void)
     sem_init(&dustDataReadySem, 0, 0);
     sem_init(&dustDataDoneSem, 0, 1);
 
-    err = pthread_create(&thread[threadCount], NULL, updateDustDataTask, NULL);
-    if (err != 0) {
-        LOG_ERR("pthread_create: %d", err);
-        return err;
-    }
-
-    threadCount++;
-    return 0;
+    return dustSensorAttach(&ioLoop, dustFrameReady, NULL);
 }
 
 static int setupGPS(void) 
@@ -157,13 +228,11 @@ static int setupGPS(void)
     sem_init(&gpsDataReadySem, 0, 0);
     sem_init(&gpsDataDoneSem, 0, 1);
 
-    err = pthread_create(&thread[threadCount], NULL, updateGPSTask, NULL);
-    if (err != 0) {
-        LOG_ERR("pthread_create: %d", err);
+    err = gpsAttach(&ioLoop);
+    if (err != 0)
         return err;
-    }
 
-    threadCount++;
+    evloopArm(&ioLoop, &gpsPublishTimer, GPS_PUBLISH_MS, gpsPublishCb, NULL);
     return 0;
 }
 
@@ -196,12 +265,31 @@ static int setupSim(void)
         .topic = MQTT_PUB_TOPIC,
         .topicLength = strlen(message.topic),
         .qos = MQTT_QOS_1,
-        .publishTimeout = PUBLISH_TIMEOUT_30S
+        .publishTimeout = PUBLISH_TIMEOUT_30S,
+        .batchSamples = MQTT_BATCH_MAX_SAMPLES,
+        .batchBytes = MESSAGE_MAX_LEN_BYTE,
+        .batchAgeMs = MQTT_BATCH_MAX_AGE_MS
     };
 
     mqttClientInit(&client);
     mqttServerInit(&server);
     mqttPublishMessageConfig(&message);
+    pppTransportInit(&client, &server, &message);
+
+    simRegisterUrcHandlers();
+    mqttRegisterUrcHandlers();
+
+    err = at_attach(&ioLoop);
+    if (err != 0)
+        return err;
+
+    err = pthread_create(&thread[threadCount], NULL, atCmdTask, NULL);
+    if (err != 0) {
+        LOG_ERR("pthread_create: %d", err);
+        return err;
+    }
+
+    threadCount++;
 
     err = pthread_create(&thread[threadCount], NULL, send2WebTask, NULL);
     if (err != 0) {
@@ -213,6 +301,22 @@ static int setupSim(void)
     return 0;
 }
 
+static int setupIoLoop(void)
+{
+    int err = evloopInit(&ioLoop);
+    if (err != 0)
+        return err;
+
+    err = pthread_create(&thread[threadCount], NULL, evloopTask, &ioLoop);
+    if (err != 0) {
+        LOG_ERR("pthread_create: %d", err);
+        return err;
+    }
+
+    threadCount++;
+    return 0;
+}
+
 static int setupDataHandler(void) 
 {
     int err = pthread_create(&thread[threadCount], NULL, dataHandlerTask, NULL);
@@ -228,9 +332,28 @@ static int setupDataHandler(void)
 
 int deviceSetup(void)
 {
-    ring_buffer_init(&json_ring_buf, json_ring_buf_data, sizeof(json_ring_buf_data));
+    int err = ring_buffer_spsc_init(&json_ring_buf, json_ring_buf_data, sizeof(json_ring_buf_data));
+    if (err != 0) {
+        LOG_ERR("Failed to setup JSON ring buffer");
+        return err;
+    }
 
-    int err = 0;
+#if TSDB_ENABLE
+    if (tsdbOpen(&flightStore, TSDB_PATH) != 0)
+        LOG_ERR("Failed to open flight data store");
+#endif
+
+#if SPOOL_ENABLE
+    if (spoolOpen(&spool, SPOOL_DIR) != 0)
+        LOG_ERR("Failed to open spool - samples are lost during outages");
+#endif
+
+    /* drivers attach to the loop; the SIM needs it running for its first commands */
+    err = setupIoLoop();
+    if (err != 0) {
+        LOG_ERR("Failed to setup I/O loop");
+        return err;
+    }
 
 #if SIM_ENALBE
     err = setupSim();
@@ -256,3 +379,18 @@ int deviceSetup(void)
 
     return err;
 }
+
+void deviceShutdown(void)
+{
+#if TSDB_ENABLE
+    pthread_mutex_lock(&storeLock);
+    tsdbClose(&flightStore);
+    pthread_mutex_unlock(&storeLock);
+#endif
+
+#if SPOOL_ENABLE
+    spoolSync(&spool);
+#endif
+
+    log_flush();
+}
@@ -6,7 +6,7 @@
 #define _DEVICE_SETUP_H_
 
 /* system macros */
-#define 	MAX_THREADS				4
+#define 	MAX_THREADS				6
 #define     RING_BUFFER_SIZE        8192
 
 /* macros are used to turn modules ON/OFF for testing */
@@ -18,6 +18,40 @@
 #define     LOG_TO_CONSOLE          1
 #define     LOG_TO_FILE             1
 #define     LOG_FILE_PATH           "doc/app.log"
+/* 1: write format ID + raw arguments to LOG_BINARY_FILE_PATH instead of text
+      (no console output; decode with tools/blogdump) */
+#define     LOG_BINARY_ENABLE       0
+#define     LOG_BINARY_FILE_PATH    "doc/app.blog"
+/* the log file is rotated by size or age; LOG_ROTATE_KEEP closed segments
+   are kept, gzip'ed by a low-priority thread */
+#define     LOG_ROTATE_BYTES        (1024 * 1024)
+#define     LOG_ROTATE_SEC          (6 * 3600)
+#define     LOG_ROTATE_KEEP         16
+#define     LOG_ROTATE_COMPRESS     1
+/* compile-time log levels: 0 off, 1 ERR, 2 WRN, 3 INF, 4 DBG.
+   Lines above the level of their module compile to nothing */
+#define     LOG_LEVEL               3
+#define     LOG_LEVEL_APP           LOG_LEVEL
+#define     LOG_LEVEL_GPS           LOG_LEVEL
+#define     LOG_LEVEL_DUST          LOG_LEVEL
+#define     LOG_LEVEL_SIM           LOG_LEVEL
+#define     LOG_LEVEL_UART          LOG_LEVEL
+#define     LOG_LEVEL_FSM           LOG_LEVEL
+#define     LOG_LEVEL_NET           LOG_LEVEL
+#define     LOG_LEVEL_STORE         LOG_LEVEL
+
+/* samples taken while the transport is down are kept on disk */
+#define     SPOOL_ENABLE            1
+#define     SPOOL_DIR               "doc/spool"
+
+/* every sample is recorded on the SD card, whatever the uplink does */
+#define     TSDB_ENABLE             1
+#define     TSDB_PATH               "doc/flight.ts"
+
+/* 1: send samples as binary records (sys/payload.h), 0: as JSON text */
+#define     PAYLOAD_BINARY_ENABLE   0
+/* binary batches: keyframe + zig-zag varint deltas instead of full records */
+#define     PAYLOAD_DELTA_ENABLE    1
 
 /* select board */
 #define     BBB                     0
@@ -30,4 +64,10 @@
  */
 int deviceSetup(void);
 
+/**
+ * @brief   flush and close the stores before the process exits
+ * @return  none
+ */
+void deviceShutdown(void);
+
 #endif
\ No newline at end of file
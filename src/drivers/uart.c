@@ -10,6 +10,8 @@
 #include <string.h>
 #include <errno.h>
 #include "uart.h"
+#define LOG_MODULE          "UART"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_UART
 #include "sys/log.h"
 
 void readUART(int fd, uint8_t* buf, int len)
@@ -43,3 +45,24 @@ int uart_init(char* UART_PATH, speed_t BR, bool nonBlock)
 
 	return uart_fd;
 }
+
+int uart_set_baud(int fd, speed_t BR)
+{
+	struct termios uart;
+
+	/* let pending output leave at the old rate first */
+	tcdrain(fd);
+	if (tcgetattr(fd, &uart) < 0) {
+		LOG_ERR("tcgetattr failed: %s", strerror(errno));
+		return -1;
+	}
+
+	cfsetispeed(&uart, BR);
+	cfsetospeed(&uart, BR);
+	if (tcsetattr(fd, TCSAFLUSH, &uart) < 0) {
+		LOG_ERR("tcsetattr failed: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -42,4 +42,12 @@ void readUART(int fd, uint8_t* buf, int len);
  */
 int uart_init(char* UART_PATH, speed_t BR, bool nonBlock);
 
+/**
+ * @brief   Change the baudrate of an opened UART, after pending output is sent
+ * @param   fd is uart file descriptor
+ * @param   BR is baudrate
+ * @return  0 if success; -1 otherwise
+ */
+int uart_set_baud(int fd, speed_t BR);
+
 #endif
\ No newline at end of file
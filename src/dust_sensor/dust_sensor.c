@@ -8,6 +8,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#define LOG_MODULE          "DUST"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_DUST
+#define LOG_MODULE_RATE_MS  10000
+#define LOG_MODULE_BURST    3
 #include "sys/log.h"
 #include "src/dust_sensor/dust_sensor.h"
 #include "src/drivers/uart.h"
@@ -16,6 +20,14 @@ static int uart_fd = 0;
 
 pm25_aqi_ctx_t dust = {0};
 
+/* frame assembly on the I/O loop; frame is the last one with a good checksum */
+static uint8_t rxBuf[DUST_DATA_FRAME];
+static size_t rxLen = 0;
+static uint8_t frame[DUST_DATA_FRAME];
+static evloop_t* rxLoop = NULL;
+static dust_frame_cb_t frameCb = NULL;
+static void* frameArg = NULL;
+
 static const int aqiRanges[AQI_LEVEL_COUNT][2] = {
     {0, 50}, 
     {51, 100},
@@ -65,38 +77,81 @@ static void pm25ToAqi(void)
     dust.aqi = (rangeAqi / rangeConcentration) * concentrationDiff + (float) dust.iLow;
 }
 
-static void readDustData(uint8_t* buf, int len)
+/* PMS7003 frame: start bytes, length (28), 13 data words, sum of the first 30 bytes */
+static bool dustParseByte(uint8_t byte)
+{
+    if ((rxLen == 0 && byte != DUST_FRAME_START1) || (rxLen == 1 && byte != DUST_FRAME_START2)) {
+        /* resync: a stray start byte may begin the next frame */
+        rxLen = (byte == DUST_FRAME_START1) ? 1 : 0;
+        return false;
+    }
+
+    rxBuf[rxLen++] = byte;
+    if (rxLen == 4 && ((rxBuf[2] << 8) | rxBuf[3]) != DUST_DATA_FRAME - 4) {
+        rxLen = 0;
+        return false;
+    }
+
+    if (rxLen < DUST_DATA_FRAME)
+        return false;
+
+    rxLen = 0;
+    uint16_t sum = 0;
+    for (int i = 0; i < DUST_DATA_FRAME - 2; i++)
+        sum += rxBuf[i];
+
+    if (sum != ((rxBuf[DUST_DATA_FRAME - 2] << 8) | rxBuf[DUST_DATA_FRAME - 1])) {
+        LOG_WRN("dust_sensor: frame checksum mismatch");
+        return false;
+    }
+
+    memcpy(frame, rxBuf, sizeof(frame));
+    return true;
+}
+
+/* readable UART on the I/O loop: every complete frame is handed on */
+static void dustSensorRead(int fd, void* arg)
 {
-    if (len < DUST_DATA_FRAME) 
-        LOG_WRN("dust_sensor: May not receive data fully");
-
-    int total = 0;
-    while (total < len) {
-        int ret = read(uart_fd, buf + total, len - total);
-        if (ret > 0) {
-            total += ret;
-        } else if (ret < 0) {
-            LOG_ERR("Read failed: %s", strerror(errno));
-            break;
+    uint8_t buf[DUST_RX_CHUNK];
+    ssize_t ret;
+
+    (void) arg;
+    while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < ret; i++) {
+            if (dustParseByte(buf[i]) && frameCb != NULL)
+                frameCb(frameArg);
         }
     }
+
+    /* a hung-up UART stays readable: stop watching it */
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        LOG_ERR("Read failed: %s", (ret == 0) ? "hang-up" : strerror(errno));
+        evloopRemoveFd(rxLoop, fd);
+    }
 }
 
 void getDustData(void)
 {
-    uint8_t dust_buf[DUST_DATA_FRAME] = {0};
-    readDustData(dust_buf, sizeof(dust_buf));
-
-    dust.pm25 = (dust_buf[12] << 8) | dust_buf[13]; 
+    dust.pm1  = (frame[10] << 8) | frame[11];
+    dust.pm25 = (frame[12] << 8) | frame[13]; 
+    dust.pm10 = (frame[14] << 8) | frame[15];
  
     pm25ToAqi();
 
     LOG_INF("PM2.5 = %d - AQI: %f", dust.pm25, dust.aqi);
 }
 
+int dustSensorAttach(evloop_t* loop, dust_frame_cb_t cb, void* arg)
+{
+    rxLoop = loop;
+    frameCb = cb;
+    frameArg = arg;
+    return evloopAddFd(loop, uart_fd, dustSensorRead, NULL);
+}
+
 int dustSensor_uart_init(char* uart_file_path)
 {
-	uart_fd = uart_init(uart_file_path, B9600, false);
+	uart_fd = uart_init(uart_file_path, B9600, true);
     if (uart_fd < 0) {
         return -1;
 	}
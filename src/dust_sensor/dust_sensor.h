@@ -5,8 +5,12 @@
 #ifndef _PMS7003_H_
 #define _PMS7003_H_
 #include <stdint.h>
+#include "sys/evloop.h"
 
 #define DUST_DATA_FRAME     32
+#define DUST_FRAME_START1   0x42
+#define DUST_FRAME_START2   0x4D
+#define DUST_RX_CHUNK       64
 #define AQI_LEVEL_COUNT     6
 
 enum aqiLevel{
@@ -24,14 +28,32 @@ struct pm25_aqi_ctx{
     float cHigh;
     float cLow;
     float aqi;
+    uint16_t pm1;
     uint16_t pm25;
+    uint16_t pm10;
 };
 
 typedef enum aqiLevel eAqiLevel;
 typedef struct pm25_aqi_ctx pm25_aqi_ctx_t;
 
+/* complete frame received, runs on the I/O loop thread */
+typedef void (*dust_frame_cb_t)(void* arg);
+
+/**
+ * @brief   Decode the last complete frame into dust and compute the AQI
+ * @return  none
+ */
 void getDustData(void);
 
+/**
+ * @brief   Assemble sensor frames from the UART on an I/O loop
+ * @param   loop is event loop that owns the UART
+ * @param   cb is called for every frame with a good checksum
+ * @param   arg is argument passed to cb
+ * @return  0 if success; -1 otherwise
+ */
+int dustSensorAttach(evloop_t* loop, dust_frame_cb_t cb, void* arg);
+
 /**
  * @brief   Initialize the UART interface for dust sensor communication
  * @param   uart_file_path is file path of UART
@@ -2,15 +2,179 @@
  * @file    fsm.c
  * @brief   Finite State Machine coordinator for SIM and transport layers
  */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#define LOG_MODULE          "FSM"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_FSM
+#include "sys/log.h"
+#include "sys/evloop.h"
 #include "sim/sim.h"
 #include "transport/mqtt.h"
 #include "transport/http.h"
+#include "transport/ppp.h"
 #include "fsm.h"
 
 static fsm_ctx_t ctx = {0};
+static atomic_uint pendingEvents = 0;
+static atomic_bool transportReady = false;
+static atomic_bool statusPollWanted = false;
+
+/* retry and periodic timers run on the I/O loop */
+extern evloop_t ioLoop;
+static timer_entry_t retryTimer;
+static timer_entry_t statusTimer;
+static atomic_bool retryPending = false;
+
+/* wakes a retry wait when an event is posted; eventFd does the same for
+   transports that poll for samples */
+static pthread_once_t eventOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eventCond;
+static int eventFd = -1;
+
+static void fsmEventCondInit(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&eventCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0)
+        LOG_ERR("FSM eventfd failed - events wait for the next sample");
+}
+
+/* loop thread: the retry is due, wake the FSM thread */
+static void fsmRetryCb(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&eventLock);
+    atomic_store(&retryPending, false);
+    pthread_cond_signal(&eventCond);
+    pthread_mutex_unlock(&eventLock);
+}
+
+/* link status runs through the AT queue, in the gaps of the data path */
+static void fsmStatusPollCb(void* arg)
+{
+    (void) arg;
+    if (atomic_load(&statusPollWanted))
+        simPollStatusAsync();
+
+    evloopArm(&ioLoop, &statusTimer, SIM_STATUS_POLL_SEC * 1000, fsmStatusPollCb, NULL);
+}
+
+/* sleep until the pending retry is due; a posted event ends the wait early */
+static void fsmWaitRetry(void)
+{
+    pthread_mutex_lock(&eventLock);
+    while (atomic_load(&retryPending) && atomic_load(&pendingEvents) == 0)
+        pthread_cond_wait(&eventCond, &eventLock);
+    pthread_mutex_unlock(&eventLock);
+
+    if (atomic_load(&retryPending)) {
+        evloopCancel(&ioLoop, &retryTimer);
+        atomic_store(&retryPending, false);
+    }
+}
+
+/* the current transport can take a sample without queueing it for later */
+static bool fsmIsTransportReady(void)
+{
+    if (ctx.layer != FSM_LAYER_TRANSPORT)
+        return false;
+
+    switch (ctx.transType)
+    {
+    case TRANSPORT_HTTP:
+        return true;
+    case TRANSPORT_MQTT:
+        return ctx.mqttState == MQTT_STATE_READY;
+    case TRANSPORT_PPP:
+        return ctx.pppState == PPP_STATE_READY;
+    default:
+        return false;
+    }
+}
+
+/* refreshed on every state change: samples go to the spool from the
+   moment the transport leaves its ready state, not after the step ends */
+static void fsmUpdateReady(void)
+{
+    atomic_store(&transportReady, fsmIsTransportReady());
+}
+
+static void fsmHandleEvents(unsigned events)
+{
+    if (events & FSM_EVENT_NET_LOST) {
+        /* only react once the link was up, bring-up handles its own failures */
+        if (ctx.transType == TRANSPORT_PPP && ctx.layer == FSM_LAYER_TRANSPORT) {
+            /* the PPP link goes down with it, hang up before AT is used again */
+            LOG_WRN("Network lost - hang up PPP");
+            ctx.pppState = PPP_STATE_HANGUP;
+        }
+        else if (ctx.layer == FSM_LAYER_TRANSPORT || ctx.simState == SIM_STATE_PDP_ACTIVE) {
+            LOG_WRN("Network lost - re-check registration");
+            ctx.layer = FSM_LAYER_SIM;
+            ctx.simState  = SIM_STATE_NET_READY;
+            ctx.mqttState = MQTT_STATE_RESET;
+        }
+        fsmUpdateReady();
+        return;
+    }
+
+    if (events & FSM_EVENT_MQTT_CONN_LOST) {
+        if (ctx.mqttState == MQTT_STATE_READY) {
+            LOG_WRN("MQTT connection lost - reconnect");
+            ctx.mqttState = MQTT_STATE_CONNECT;
+        }
+    }
+    fsmUpdateReady();
+}
+
+void fsmPostEvent(eFsmEvent event)
+{
+    pthread_once(&eventOnce, fsmEventCondInit);
+
+    atomic_fetch_or(&pendingEvents, event);
+
+    uint64_t one = 1;
+    if (eventFd >= 0 && write(eventFd, &one, sizeof(one)) < 0) {
+        /* counter saturated; the FSM is already due to wake up */
+    }
+
+    pthread_mutex_lock(&eventLock);
+    pthread_cond_signal(&eventCond);
+    pthread_mutex_unlock(&eventLock);
+}
+
+void fsmRetryAfter(uint32_t delayMs)
+{
+    atomic_store(&retryPending, true);
+    evloopArm(&ioLoop, &retryTimer, delayMs, fsmRetryCb, NULL);
+}
 
 void fsmHandler(void)
 {
+    fsmWaitRetry();
+
+    /* drained before the events are taken, so that none is left unseen */
+    uint64_t cnt;
+    if (eventFd >= 0 && read(eventFd, &cnt, sizeof(cnt)) < 0) {
+        /* nothing posted */
+    }
+
+    unsigned events = atomic_exchange(&pendingEvents, 0);
+    if (events)
+        fsmHandleEvents(events);
+
     switch (ctx.layer)
     {
     case FSM_LAYER_SIM:
@@ -26,6 +190,9 @@ void fsmHandler(void)
         case TRANSPORT_MQTT:
             mqttFsmHandler(ctx.mqttState);
             break;
+        case TRANSPORT_PPP:
+            pppFsmHandler(ctx.pppState);
+            break;
         default:
             break;
         }
@@ -34,11 +201,32 @@ void fsmHandler(void)
     default:
         break;
     }
+
+    fsmUpdateReady();
+    atomic_store(&statusPollWanted, ctx.layer == FSM_LAYER_TRANSPORT && ctx.transType != TRANSPORT_PPP);
+}
+
+int fsmEventFd(void)
+{
+    pthread_once(&eventOnce, fsmEventCondInit);
+    return eventFd;
+}
+
+bool fsmEventPending(void)
+{
+    struct pollfd pfd = { .fd = fsmEventFd(), .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+bool fsmTransportReady(void)
+{
+    return atomic_load(&transportReady);
 }
 
 void setFsmLayer(eFsmLayer layer)
 {
     ctx.layer = layer;
+    fsmUpdateReady();
 }
 
 void setSimState(eSimState state)
@@ -54,6 +242,7 @@ eSimState getSimState(void)
 void setMqttState(eMqttState state)
 {
     ctx.mqttState = state;
+    fsmUpdateReady();
 }
 
 eMqttState getMqttState(void)
@@ -64,6 +253,7 @@ eMqttState getMqttState(void)
 void setHttpState(eHttpState state)
 {
     ctx.httpState = state;
+    fsmUpdateReady();
 }
 
 eHttpState getHttpState(void)
@@ -71,11 +261,32 @@ eHttpState getHttpState(void)
     return ctx.httpState;
 }
 
+eTransportType getTransportType(void)
+{
+    return ctx.transType;
+}
+
+void setPppState(ePppState state)
+{
+    ctx.pppState = state;
+    fsmUpdateReady();
+}
+
+ePppState getPppState(void)
+{
+    return ctx.pppState;
+}
+
 void fsm_context_init(void)
 {
     ctx.layer = FSM_LAYER_SIM;
-    ctx.transType = TRANSPORT_MQTT;
+    ctx.transType = FSM_TRANSPORT_DEFAULT;
     ctx.simState  = SIM_STATE_RESET;
     ctx.mqttState = MQTT_STATE_RESET;
     ctx.httpState = HTTP_STATE_PREPARE;
+    ctx.pppState  = PPP_STATE_DIAL;
+
+    pthread_once(&eventOnce, fsmEventCondInit);
+    atomic_store(&retryPending, false);
+    evloopArm(&ioLoop, &statusTimer, SIM_STATUS_POLL_SEC * 1000, fsmStatusPollCb, NULL);
 }
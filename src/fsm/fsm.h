@@ -4,6 +4,7 @@
  */
 #ifndef _FSM_H_
 #define _FSM_H_
+#include <stdint.h>
 
 enum simState {
     SIM_STATE_RESET,
@@ -27,21 +28,40 @@ enum httpState {
     HTTP_STATE_STOP
 };
 
+enum pppState {
+    PPP_STATE_DIAL,
+    PPP_STATE_LINK,
+    PPP_STATE_CONNECT,
+    PPP_STATE_READY,
+    PPP_STATE_HANGUP
+};
+
 enum fsmLayer {
     FSM_LAYER_SIM,
     FSM_LAYER_TRANSPORT
 };
 
+/* events posted from other threads (e.g. URC handlers), handled by fsmHandler */
+enum fsmEvent {
+    FSM_EVENT_NET_LOST       = 1 << 0,
+    FSM_EVENT_MQTT_CONN_LOST = 1 << 1
+};
+
 enum transportType {
     TRANSPORT_HTTP,
-    TRANSPORT_MQTT
+    TRANSPORT_MQTT,
+    TRANSPORT_PPP           // pppd over the SIM UART + MQTT from the Linux side
 };
 
+#define FSM_TRANSPORT_DEFAULT   TRANSPORT_MQTT
+
 typedef enum fsmLayer  eFsmLayer; 
 typedef enum simState  eSimState;
 typedef enum mqttState eMqttState;
 typedef enum httpState eHttpState;
+typedef enum pppState  ePppState;
 typedef enum transportType eTransportType;
+typedef enum fsmEvent eFsmEvent;
 
 struct fsm_context_t
 {
@@ -50,6 +70,7 @@ struct fsm_context_t
     eTransportType transType;
     eMqttState mqttState;
     eHttpState httpState;
+    ePppState pppState;
 };
 
 typedef struct fsm_context_t fsm_ctx_t;
@@ -60,6 +81,44 @@ typedef struct fsm_context_t fsm_ctx_t;
  */
 void fsmHandler(void);
 
+/**
+ * @brief Post an event to the FSM, safe to call from any thread.
+ *        It is handled at the start of the next fsmHandler() call.
+ * @param event FSM event to post.
+ * @return none.
+ */
+void fsmPostEvent(eFsmEvent event);
+
+/**
+ * @brief Run the current state again after a delay instead of right away.
+ *        The next fsmHandler() call sleeps until then; a posted event ends the wait.
+ *        Call from the FSM thread only.
+ * @param delayMs Delay in milliseconds.
+ * @return none.
+ */
+void fsmRetryAfter(uint32_t delayMs);
+
+/**
+ * @brief Get an fd that turns readable when an event is posted, so that a
+ *        transport waiting for samples can return and let fsmHandler() run.
+ *        Drained by fsmHandler(); do not read it.
+ * @return eventfd; -1 if it could not be created.
+ */
+int fsmEventFd(void);
+
+/**
+ * @brief Check whether fsmEventFd() is readable, without draining it.
+ * @return true if an event was posted since fsmHandler() last ran.
+ */
+bool fsmEventPending(void);
+
+/**
+ * @brief Check whether the transport could deliver a sample right now.
+ *        Updated on every FSM state change, safe to call from any thread.
+ * @return true if the transport layer is up and ready to send; false otherwise.
+ */
+bool fsmTransportReady(void);
+
 /**
  * @brief Set current FSM layer.
  * @param layer FSM layer to switch to.
@@ -106,6 +165,25 @@ void setHttpState(eHttpState state);
  */
 eHttpState getHttpState(void);
 
+/**
+ * @brief Get the transport selected for the transport layer.
+ * @return Current transport type.
+ */
+eTransportType getTransportType(void);
+
+/**
+ * @brief Set current PPP state.
+ * @param state PPP state to set.
+ * @return none.
+ */
+void setPppState(ePppState state);
+
+/**
+ * @brief Get current PPP state.
+ * @return Current PPP state.
+ */
+ePppState getPppState(void);
+
 /**
  * @brief Initialize FSM context and default states.
  * @return none.
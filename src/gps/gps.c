@@ -8,9 +8,14 @@
 #include <fcntl.h>
 #include <math.h>
 #include <errno.h>
+#define LOG_MODULE          "GPS"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_GPS
+#define LOG_MODULE_RATE_MS  5000
+#define LOG_MODULE_BURST    5
 #include "sys/log.h"
 #include "src/gps/gps.h"
 #include "src/drivers/uart.h"
+#include "sys/evloop.h"
 #include "ext/mavlink/c_library_v2/common/mavlink.h"
 
 static int uart_fd = 0;
@@ -26,6 +31,17 @@ static int16_t vy_cm_s;
 
 static bool gpsValid = false;
 
+/* state parsed on the I/O loop; gpsPublish() copies it to the fields above */
+static gps_ctx_t rx = {
+    .lat = DEFAULT_LATITUDE,
+    .lon = DEFAULT_LONGITUDE,
+    .alt = DEFAULT_ALTITUDE
+};
+static int16_t rxVx;
+static int16_t rxVy;
+static bool rxValid = false;
+static evloop_t* rxLoop = NULL;
+
 static mavlink_message_t mav_msg;
 static mavlink_status_t  mav_status;
 
@@ -37,15 +53,17 @@ static void gpsHandleMavlinkMsg(mavlink_message_t *msg)
         {
             mavlink_gps_raw_int_t gps_raw;
             mavlink_msg_gps_raw_int_decode(msg, &gps_raw);
+            rx.fixType = gps_raw.fix_type;
+            rx.satellites = gps_raw.satellites_visible;
 
             if (gps_raw.fix_type >= 2 && gps_raw.satellites_visible >= 5) {
-                gpsValid = true;
+                rxValid = true;
                 LOG_INF("GPS_RAW_INT: Valid GPS (fix_type: %d, sats: %d)", 
                         gps_raw.fix_type, gps_raw.satellites_visible);
             } 
             
             if (gps_raw.fix_type < 2 || gps_raw.satellites_visible < 4) {
-                gpsValid = false;
+                rxValid = false;
                 LOG_WRN("GPS_RAW_INT: Invalid GPS (fix_type: %d, sats: %d)", 
                         gps_raw.fix_type, gps_raw.satellites_visible);
             }
@@ -58,26 +76,24 @@ static void gpsHandleMavlinkMsg(mavlink_message_t *msg)
             mavlink_global_position_int_t pos;
             mavlink_msg_global_position_int_decode(msg, &pos);
 
-            if (gpsValid) {
-                gps.lat = (double) pos.lat / 1e7;
-                gps.lon = (double) pos.lon / 1e7;
-                gps.alt = (double) pos.relative_alt / 1000.0;
-                vx_cm_s = pos.vx;
-                vy_cm_s = pos.vy;
+            if (rxValid) {
+                rx.lat = (double) pos.lat / 1e7;
+                rx.lon = (double) pos.lon / 1e7;
+                rx.alt = (double) pos.relative_alt / 1000.0;
+                rxVx = pos.vx;
+                rxVy = pos.vy;
                 LOG_INF("GLOBAL_POSITION_INT: lat: %.7f - lon: %.7f - alt: %.2f", 
-                        gps.lat, gps.lon, gps.alt);
+                        rx.lat, rx.lon, rx.alt);
 
-                LOG_INF("GLOBAL_POSITION_INT: vx: %.2f m/s - vy: %.2f m/s", 
-                        vx_cm_s / 100.0, vy_cm_s / 100.0);
+                LOG_DBG("GLOBAL_POSITION_INT: vx: %.2f m/s - vy: %.2f m/s", 
+                        rxVx / 100.0, rxVy / 100.0);
             }
 
             break;
         }
 
         default:
-#if GPS_DEBUG_MSG_IDS
-            LOG_INF("Received MAVLink message ID: %d", msg->msgid);
-#endif
+            LOG_DBG("Received MAVLink message ID: %d", msg->msgid);
             break;
     }
 }
@@ -107,40 +123,49 @@ bool isDroneHovering(void)
     return (stableCounter >= HOVER_TIME_REQUIRED_SEC);
 }
 
-void gpsReadMavlink(void)
+/* readable UART on the I/O loop: parse everything that arrived */
+static void gpsRead(int fd, void* arg)
 {
-    uint8_t byte;
-    int ret;
+    uint8_t buf[GPS_RX_CHUNK];
     int bytes_read = 0;
     int messages_received = 0;
+    ssize_t ret;
 
-    for (int i = 0; i < 512; i++) {
-        ret = read(uart_fd, &byte, 1);
-
-        if (ret == 1) {
-            bytes_read++;
-            if (mavlink_parse_char(MAVLINK_COMM_0, byte, &mav_msg, &mav_status)) {
+    (void) arg;
+    while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+        bytes_read += ret;
+        for (ssize_t i = 0; i < ret; i++) {
+            if (mavlink_parse_char(MAVLINK_COMM_0, buf[i], &mav_msg, &mav_status)) {
                 messages_received++;
                 gpsHandleMavlinkMsg(&mav_msg);
             }
-        } else {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                break;   
-            } else if (errno != 0) {
-                LOG_ERR("UART read error: %s (errno: %d)", strerror(errno), errno);
-                break;
-            } else {
-                break;
-            }
         }
     }
 
-#if GPS_DEBUG_MSG_IDS
-    if (bytes_read > 0)
-        LOG_INF("Read %d bytes, received %d MAVLink messages", bytes_read, messages_received);
-    else if (bytes_read > 0 && messages_received == 0) 
-        LOG_WRN("Read %d bytes but no complete MAVLink message received", bytes_read);
-#endif
+    /* a hung-up UART stays readable: stop watching it */
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        LOG_ERR("UART read error: %s (errno: %d)", (ret == 0) ? "hang-up" : strerror(errno), errno);
+        evloopRemoveFd(rxLoop, fd);
+    }
+
+    if (bytes_read > 0 && messages_received == 0)
+        LOG_DBG("Read %d bytes but no complete MAVLink message received", bytes_read);
+    else if (bytes_read > 0)
+        LOG_DBG("Read %d bytes, received %d MAVLink messages", bytes_read, messages_received);
+}
+
+void gpsPublish(void)
+{
+    gps = rx;
+    vx_cm_s = rxVx;
+    vy_cm_s = rxVy;
+    gpsValid = rxValid;
+}
+
+int gpsAttach(evloop_t* loop)
+{
+    rxLoop = loop;
+    return evloopAddFd(loop, uart_fd, gpsRead, NULL);
 }
 
 int GPS_uart_init(char* uart_file_path)
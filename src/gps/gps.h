@@ -5,6 +5,8 @@
 #ifndef _GPS_H_
 #define _GPS_H_
 #include <stdint.h>
+#include <stdbool.h>
+#include "sys/evloop.h"
 
 /* Default latitude and longitude values.
  * Here set to the coordinates of Ton Duc Thang University (TDTU), Ho Chi Minh City. 
@@ -13,16 +15,19 @@
 #define     DEFAULT_LONGITUDE       106.6981f
 #define     DEFAULT_ALTITUDE        10
 
-// Debug flag - set to 1 to log all message IDs
-#define     GPS_DEBUG_MSG_IDS       0
-
 #define     HOVER_SPEED_THRESHOLD_CM_S      20.0
 #define     HOVER_TIME_REQUIRED_SEC         4       
 
+#define     GPS_RX_CHUNK            256
+/* how often the latest fix is handed to the data handler */
+#define     GPS_PUBLISH_MS          1000
+
 typedef struct {
     double lat;
     double lon;
     double alt;
+    uint8_t fixType;
+    uint8_t satellites;
 } gps_ctx_t;
 
 /**
@@ -32,10 +37,18 @@ typedef struct {
 bool isDroneHovering(void);
 
 /**
- * @brief   Read and parse MAVLink messages from GPS
+ * @brief   Parse MAVLink messages from the GPS UART on an I/O loop
+ * @param   loop is event loop that owns the UART
+ * @return  0 if success; -1 otherwise
+ */
+int gpsAttach(evloop_t* loop);
+
+/**
+ * @brief   Copy the latest parsed fix and velocity to gps and the hover check.
+ *          Call on the loop thread while the reader of gps is not using it.
  * @return  none
  */
-void gpsReadMavlink(void);
+void gpsPublish(void);
 
 /**
  * @brief   Initialize the UART interface for GPS communication
@@ -1,20 +1,29 @@
 #include <pthread.h>
+#include <signal.h>
+#define LOG_MODULE          "APP"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_APP
 #include "sys/log.h"
 #include "device_setup.h"
 
-extern pthread_t thread[MAX_THREADS];
-extern int threadCount;
-
 int main(void)
 {
+	/* blocked before any thread starts, so only the sigwait() below takes them */
+	sigset_t stop;
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
 	LOG_INF("=== APP START ===");
 
 	deviceSetup();	
 
-	for (int i = 0; i < threadCount; i++) {
-		void* tmp;
-		pthread_join(thread[i], &tmp);
-	}
+	/* the worker threads never return; the service stops with SIGTERM */
+	int sig = 0;
+	sigwait(&stop, &sig);
+	LOG_INF("Signal %d - shutting down", sig);
+
+	deviceShutdown();
 
 	LOG_INF("=== APP END ===");
 	return 0;
@@ -9,31 +9,510 @@
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#define LOG_MODULE          "SIM"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_SIM
 #include "sys/log.h"
+#include "sys/retry.h"
 #include "at.h"
 #include "src/drivers/uart.h"
 
 static int uart_fd = 0;
+static volatile int uartBaud = SIM_UART_BAUD_DEFAULT;
+static const char* uartPath = NULL;
 
-static uint64_t now_ms()
+/* set by the I/O loop on CONNECT, the UART then belongs to pppd */
+static volatile bool dataMode = false;
+static evloop_t* rxLoop = NULL;
+
+/* command currently waiting for its response, filled by the I/O loop */
+static struct {
+    bool active;
+    char* buf;
+    size_t len;
+    size_t idx;
+    char prefix[32];
+    at_parser_t parser;
+} pending = {0};
+
+static pthread_mutex_t rxLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  rxCond;
+
+/* blocking request from at_send_expect(), run ahead of the async queue */
+typedef struct {
+    const char* cmd;
+    size_t cmdLen;              // 0: cmd is a null-terminated command
+    char* buf;
+    size_t len;
+    uint64_t timeout_ms;
+    const char* expect;
+    int final;
+    bool done;
+} at_sync_req_t;
+
+/* queued request from at_submit() */
+typedef struct {
+    char cmd[AT_ASYNC_CMD_LEN];
+    const char* expect;
+    uint64_t timeout_ms;
+    at_cmd_cb_t cb;
+    void* arg;
+} at_async_req_t;
+
+static pthread_mutex_t syncLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queueCond;
+static at_sync_req_t* syncReq = NULL;
+static at_async_req_t queue[AT_QUEUE_LEN];
+static int queueHead = 0;
+static int queueCount = 0;
+
+static struct {
+    const char* prefix;
+    at_urc_cb_t cb;
+} urcHandlers[AT_MAX_URC_HANDLERS];
+static int urcCount = 0;
+
+static eAtFinal at_classify_line(const char* line, size_t len)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (len == 2 && memcmp(line, "OK", 2) == 0)
+        return AT_FINAL_OK;
+
+    if (len == 5 && memcmp(line, "ERROR", 5) == 0)
+        return AT_FINAL_ERROR;
+
+    if (len >= 10 && (memcmp(line, "+CME ERROR", 10) == 0 || memcmp(line, "+CMS ERROR", 10) == 0))
+        return AT_FINAL_CME_ERROR;
+
+    if (len == 8 && memcmp(line, "DOWNLOAD", 8) == 0)
+        return AT_FINAL_DOWNLOAD;
+
+    if (len >= 7 && memcmp(line, "CONNECT", 7) == 0)
+        return AT_FINAL_CONNECT;
+
+    /* dial failures */
+    if ((len == 10 && memcmp(line, "NO CARRIER", 10) == 0) ||
+        (len == 4 && memcmp(line, "BUSY", 4) == 0) ||
+        (len == 11 && memcmp(line, "NO DIALTONE", 11) == 0))
+        return AT_FINAL_ERROR;
+
+    return AT_FINAL_NONE;
 }
 
-int at_send_wait(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms)
+static void at_parser_end_line(at_parser_t* parser)
+{
+    size_t len = (parser->lineLen < AT_LINE_MAX) ? parser->lineLen : AT_LINE_MAX;
+
+    if (parser->expect != NULL && !parser->expectSeen) {
+        size_t n = strlen(parser->expect);
+        if (len >= n && memcmp(parser->line, parser->expect, n) == 0)
+            parser->expectSeen = true;
+    }
+
+    if (parser->final == AT_FINAL_NONE)
+        parser->final = at_classify_line(parser->line, len);
+
+    parser->lineLen = 0;
+}
+
+void at_parser_reset(at_parser_t* parser, const char* expect)
+{
+    parser->lineLen = 0;
+    parser->final = AT_FINAL_NONE;
+    parser->expect = expect;
+    parser->expectSeen = false;
+}
+
+bool at_parser_done(at_parser_t* parser)
+{
+    switch (parser->final) {
+    case AT_FINAL_NONE:
+        return false;
+    case AT_FINAL_ERROR:
+    case AT_FINAL_CME_ERROR:
+        return true;
+    default:
+        return (parser->expect == NULL || parser->expectSeen);
+    }
+}
+
+eAtFinal at_parser_feed(at_parser_t* parser, const char* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\r')
+            continue;
+
+        if (c == '\n') {
+            at_parser_end_line(parser);
+            continue;
+        }
+
+        /* '>' prompt is not line-terminated, detect it at the start of a line */
+        if (c == '>' && parser->lineLen == 0 && parser->final == AT_FINAL_NONE) {
+            parser->final = AT_FINAL_PROMPT;
+            continue;
+        }
+
+        /* only the head of a line is needed to classify it */
+        if (parser->lineLen < AT_LINE_MAX)
+            parser->line[parser->lineLen] = c;
+        parser->lineLen++;
+    }
+
+    return parser->final;
+}
+
+static at_urc_cb_t at_urc_handler(const char* line)
+{
+    for (int i = 0; i < urcCount; i++) {
+        if (strncmp(line, urcHandlers[i].prefix, strlen(urcHandlers[i].prefix)) == 0)
+            return urcHandlers[i].cb;
+    }
+
+    return NULL;
+}
+
+/* append text to the waiting command's response; called with rxLock held */
+static void at_pending_append(const char* text, size_t len)
+{
+    size_t room = pending.len - 1 - pending.idx;
+    size_t n = (len < room) ? len : room;
+
+    memcpy(pending.buf + pending.idx, text, n);
+    pending.idx += n;
+    pending.buf[pending.idx] = '\0';
+
+    at_parser_feed(&pending.parser, text, len);
+    if (at_parser_done(&pending.parser))
+        pthread_cond_signal(&rxCond);
+}
+
+/* route one complete line to the waiting command or to a URC handler */
+static void at_dispatch_line(const char* line, size_t len)
+{
+    if (len == 0)
+        return;
+
+    at_urc_cb_t cb = at_urc_handler(line);
+
+    pthread_mutex_lock(&rxLock);
+    if (pending.active) {
+        bool ownLine = (pending.prefix[0] != '\0' &&
+                        strncmp(line, pending.prefix, strlen(pending.prefix)) == 0) ||
+                       (pending.parser.expect != NULL &&
+                        strncmp(line, pending.parser.expect, strlen(pending.parser.expect)) == 0);
+
+        if (ownLine || cb == NULL) {
+            at_pending_append("\r\n", 2);
+            at_pending_append(line, len);
+            at_pending_append("\r\n", 2);
+            pthread_mutex_unlock(&rxLock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&rxLock);
+
+    if (cb != NULL)
+        cb(line);
+    else
+        LOG_WRN("Unhandled URC: %s", line);
+}
+
+void at_rx_bytes(const char* data, size_t len)
+{
+    static char line[RESP_FRAME];
+    static size_t lineLen = 0;
+    static bool afterPrompt = false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (afterPrompt) {
+            afterPrompt = false;
+            if (c == ' ')
+                continue;
+        }
+
+        if (c == '\r')
+            continue;
+
+        if (c == '\n') {
+            line[lineLen] = '\0';
+            at_dispatch_line(line, lineLen);
+
+            /* what follows CONNECT is PPP: stop reading, pppd owns the UART now 
+               (frames already in this chunk are lost, LCP retries cover them) */
+            if (at_classify_line(line, lineLen) == AT_FINAL_CONNECT) {
+                dataMode = true;
+                lineLen = 0;
+                return;
+            }
+
+            lineLen = 0;
+            continue;
+        }
+
+        /* '>' prompt is not line-terminated, hand it over right away */
+        if (c == '>' && lineLen == 0) {
+            pthread_mutex_lock(&rxLock);
+            if (pending.active)
+                at_pending_append(">", 1);
+            pthread_mutex_unlock(&rxLock);
+            afterPrompt = true;
+            continue;
+        }
+
+        /* overlong lines are truncated */
+        if (lineLen < sizeof(line) - 1)
+            line[lineLen++] = c;
+    }
+}
+
+/* readable UART on the I/O loop; once CONNECT hands it to pppd, stop watching it */
+static void at_on_readable(int fd, void* arg)
 {
-    int written = at_send(cmd, strlen(cmd));
+    char rx[RESP_FRAME];
+    ssize_t ret = -1;
+
+    (void) arg;
+    while (!dataMode && (ret = read(fd, rx, sizeof(rx))) > 0)
+        at_rx_bytes(rx, ret);
+
+    if (dataMode) {
+        evloopRemoveFd(rxLoop, fd);
+    }
+    else if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        LOG_ERR("Read failed: %s", (ret == 0) ? "hang-up" : strerror(errno));
+        evloopRemoveFd(rxLoop, fd);
+    }
+}
+
+int at_attach(evloop_t* loop)
+{
+    rxLoop = loop;
+    return evloopAddFd(loop, uart_fd, at_on_readable, NULL);
+}
+
+int at_register_urc(const char* prefix, at_urc_cb_t cb)
+{
+    if (prefix == NULL || cb == NULL || urcCount >= AT_MAX_URC_HANDLERS)
+        return -1;
+
+    urcHandlers[urcCount].prefix = prefix;
+    urcHandlers[urcCount].cb = cb;
+    urcCount++;
+    return 0;
+}
+
+static void at_deadline(struct timespec* ts, uint64_t timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* "AT+CMQTTPUB=0,1,60" -> "+CMQTTPUB", lines starting with it belong to the command */
+static void at_cmd_prefix(const char* cmd, char* prefix, size_t len)
+{
+    prefix[0] = '\0';
+    if (strncmp(cmd, "AT+", 3) != 0)
+        return;
+
+    size_t n = strcspn(cmd + 2, "=?\r\n");
+    if (n >= len)
+        n = len - 1;
+
+    memcpy(prefix, cmd + 2, n);
+    prefix[n] = '\0';
+}
+
+/* run one command on the owner thread: send it and wait for the reader to complete it;
+   cmdLen > 0 marks raw data after a prompt, sent as is and not logged */
+static int at_run_cmd(const char* cmd, size_t cmdLen, char* recv_buf, size_t len, uint64_t timeout_ms, const char* expect)
+{
+    bool data = (cmdLen > 0);
+
+
+    if (dataMode) {
+        LOG_WRN("Data mode - drop %s", data ? "data" : cmd);
+        return -1;
+    }
+
+    if (!data)
+        cmdLen = strlen(cmd);
+
+    pthread_mutex_lock(&rxLock);
+    pending.buf = recv_buf;
+    pending.len = len;
+    pending.idx = 0;
+    recv_buf[0] = '\0';
+    if (data)
+        pending.prefix[0] = '\0';
+    else
+        at_cmd_prefix(cmd, pending.prefix, sizeof(pending.prefix));
+    at_parser_reset(&pending.parser, expect);
+    pending.active = true;
+    pthread_mutex_unlock(&rxLock);
+
+    uint64_t start = retryNowMs();
+    int written = at_send((char*) cmd, cmdLen);
+
+    struct timespec deadline;
+    at_deadline(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&rxLock);
+    while (written >= 0 && !at_parser_done(&pending.parser)) {
+        if (pthread_cond_timedwait(&rxCond, &rxLock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pending.active = false;
+    /* OK without the expected URC is a timeout, not a success */
+    eAtFinal final = at_parser_done(&pending.parser) ? pending.parser.final : AT_FINAL_NONE;
+    pthread_mutex_unlock(&rxLock);
+
     if (written < 0) 
         return -1;
 
-    int num = at_read(recv_buf, len, timeout_ms);
-    if (num < 0) 
+    if (data)
+        LOG_INF("Send: %u data bytes\nResponse:%s (%d ms)", (unsigned) cmdLen, recv_buf, (int) (retryNowMs() - start));
+    else
+        LOG_INF("Send: %s\nResponse:%s (%d ms)", cmd, recv_buf, (int) (retryNowMs() - start));
+    return final;    
+}
+
+void* atCmdTask(void* arg)
+{
+    bool dataExpected = false;
+
+    while (1) {
+        struct timespec deadline;
+        at_deadline(&deadline, AT_DATA_WAIT_MS);
+
+        pthread_mutex_lock(&queueLock);
+        while (syncReq == NULL && (dataExpected || queueCount == 0)) {
+            if (!dataExpected) {
+                pthread_cond_wait(&queueCond, &queueLock);
+                continue;
+            }
+
+            int ret = pthread_cond_timedwait(&queueCond, &queueLock, &deadline);
+            if (ret == ETIMEDOUT) {
+                /* the caller gave up on the prompt, do not hold the queue forever */
+                LOG_WRN("No data after input prompt - resume queue");
+                dataExpected = false;
+            }
+        }
+
+        /* blocking callers first; after a prompt only they may send (the data) */
+        if (syncReq != NULL) {
+            at_sync_req_t* req = syncReq;
+            pthread_mutex_unlock(&queueLock);
+
+            int final = at_run_cmd(req->cmd, req->cmdLen, req->buf, req->len, req->timeout_ms, req->expect);
+
+            pthread_mutex_lock(&queueLock);
+            req->final = final;
+            req->done = true;
+            syncReq = NULL;
+            pthread_cond_broadcast(&queueCond);
+            pthread_mutex_unlock(&queueLock);
+
+            dataExpected = (final == AT_FINAL_PROMPT || final == AT_FINAL_DOWNLOAD);
+            continue;
+        }
+
+        at_async_req_t req = queue[queueHead];
+        queueHead = (queueHead + 1) % AT_QUEUE_LEN;
+        queueCount--;
+        pthread_mutex_unlock(&queueLock);
+
+        char resp[RESP_FRAME];
+        int final = at_run_cmd(req.cmd, 0, resp, sizeof(resp), req.timeout_ms, req.expect);
+        if (req.cb != NULL)
+            req.cb(req.arg, final, resp);
+
+        dataExpected = (final == AT_FINAL_PROMPT || final == AT_FINAL_DOWNLOAD);
+    }
+
+    return arg;
+}
+
+int at_submit(const char* cmd, const char* expect, uint64_t timeout_ms, at_cmd_cb_t cb, void* arg)
+{
+    if (cmd == NULL || strlen(cmd) >= AT_ASYNC_CMD_LEN)
+        return -1;
+
+    pthread_mutex_lock(&queueLock);
+    if (queueCount >= AT_QUEUE_LEN) {
+        pthread_mutex_unlock(&queueLock);
+        LOG_WRN("AT queue full - drop %s", cmd);
         return -1;
+    }
 
-    LOG_INF("Send: %s\nResponse:%s", cmd, recv_buf);
-    return 0;    
+    at_async_req_t* req = &queue[(queueHead + queueCount) % AT_QUEUE_LEN];
+    strcpy(req->cmd, cmd);
+    req->expect = expect;
+    req->timeout_ms = timeout_ms;
+    req->cb = cb;
+    req->arg = arg;
+    queueCount++;
+
+    pthread_cond_broadcast(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+    return 0;
+}
+
+/* hand a blocking request to the owner thread and wait for its result */
+static int at_run_sync(const char* cmd, size_t cmdLen, char* recv_buf, size_t len, uint64_t timeout_ms, const char* expect)
+{
+    if (recv_buf == NULL || len == 0)
+        return -1;
+
+    at_sync_req_t req = {
+        .cmd = cmd,
+        .cmdLen = cmdLen,
+        .buf = recv_buf,
+        .len = len,
+        .timeout_ms = timeout_ms,
+        .expect = expect,
+        .done = false
+    };
+
+    /* one blocking caller at a time; it waits for the owner thread to run its command */
+    pthread_mutex_lock(&syncLock);
+    pthread_mutex_lock(&queueLock);
+    syncReq = &req;
+    pthread_cond_broadcast(&queueCond);
+    while (!req.done)
+        pthread_cond_wait(&queueCond, &queueLock);
+    pthread_mutex_unlock(&queueLock);
+    pthread_mutex_unlock(&syncLock);
+
+    return req.final;
+}
+
+int at_send_expect(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms, const char* expect)
+{
+    return at_run_sync(cmd, 0, recv_buf, len, timeout_ms, expect);
+}
+
+int at_send_data(const void* data, size_t data_len, char* recv_buf, size_t len, uint64_t timeout_ms)
+{
+    if (data == NULL || data_len == 0)
+        return -1;
+
+    return at_run_sync(data, data_len, recv_buf, len, timeout_ms, NULL);
+}
+
+int at_send_wait(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms)
+{
+    return at_send_expect(cmd, recv_buf, len, timeout_ms, NULL);
 }
 
 int at_send(char* cmd, size_t len)
@@ -59,58 +538,78 @@ int at_send(char* cmd, size_t len)
     return total;
 }
 
-int at_read(char* buf, size_t max_len, uint64_t timeout_ms)
+static speed_t at_baud_to_speed(int baud)
 {
-    if (uart_fd < 0 || buf == NULL || max_len == 0)
-        return -1;
-
-    size_t idx = 0;
-    uint64_t start = now_ms();
-    uint64_t last_rx = now_ms();   
-
-    const uint64_t QUIET_MS = 80;  
-
-    while (1)
-    {
-        if (idx >= max_len - 1)
-            break;
+    switch (baud) {
+    case 9600:      return B9600;
+    case 19200:     return B19200;
+    case 38400:     return B38400;
+    case 57600:     return B57600;
+    case 115200:    return B115200;
+    case 230400:    return B230400;
+    case 460800:    return B460800;
+    case 921600:    return B921600;
+    default:        return B0;
+    }
+}
 
-        char c;
-        ssize_t ret = read(uart_fd, &c, 1);
+int at_set_baud(int baud)
+{
+    speed_t speed = at_baud_to_speed(baud);
+    if (speed == B0 || uart_fd < 0)
+        return -1;
 
-        if (ret > 0) {
-            buf[idx++] = c;
-            last_rx = now_ms();
-        }
-        else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            LOG_ERR("Read failed: %s", strerror(errno));
-            return -1;
-        }
+    if (uart_set_baud(uart_fd, speed) < 0)
+        return -1;
 
-        buf[idx] = '\0';
+    uartBaud = baud;
+    LOG_INF("SIM UART baudrate: %d", baud);
+    return 0;
+}
 
-        bool have_ok    = (strstr(buf, "\r\nOK\r\n")    != NULL);
-        bool have_error = (strstr(buf, "\r\nERROR\r\n") != NULL);
+int at_get_baud(void)
+{
+    return uartBaud;
+}
 
-        if ((have_ok || have_error) && (now_ms() - last_rx >= QUIET_MS)) 
-            break;
+bool at_in_data_mode(void)
+{
+    return dataMode;
+}
 
-        if (now_ms() - start >= timeout_ms)
-            break;
+void at_leave_data_mode(void)
+{
+    if (uart_fd >= 0)
+        tcflush(uart_fd, TCIFLUSH);
 
-        usleep(1000);
+    /* the loop dropped the UART on CONNECT, watch it again */
+    if (dataMode && rxLoop != NULL) {
+        dataMode = false;
+        evloopAddFd(rxLoop, uart_fd, at_on_readable, NULL);
     }
+    dataMode = false;
+}
 
-    buf[idx] = '\0';
-    return idx;
+const char* at_get_uart_path(void)
+{
+    return uartPath;
 }
 
 int sim_uart_init(char* uart_file_path)
 {
-    uart_fd = uart_init(uart_file_path, B9600, true);
+    uart_fd = uart_init(uart_file_path, at_baud_to_speed(SIM_UART_BAUD_DEFAULT), true);
     if (uart_fd < 0) {
         return -1;
 	}
+    uartPath = uart_file_path;
+
+    /* response deadlines are measured on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rxCond, &attr);
+    pthread_cond_init(&queueCond, &attr);
+    pthread_condattr_destroy(&attr);
     
 	LOG_INF("Sim Initialization successful");
     return 0;
@@ -6,7 +6,90 @@
 #define _AT_H_
 #include <stdint.h>
 
+#include <stddef.h>
+#include <stdbool.h>
+#include "sys/evloop.h"
+
 #define RESP_FRAME                  256
+#define SIM_UART_BAUD_DEFAULT       9600
+#define SIM_UART_BAUD_FAST          115200
+#define AT_LINE_MAX                 64
+#define AT_MAX_URC_HANDLERS         8
+#define AT_QUEUE_LEN                8
+#define AT_ASYNC_CMD_LEN            128
+#define AT_DATA_WAIT_MS             2000
+
+/* time needed to clock n bytes out on the SIM UART (8N1 = 10 bits per byte) */
+#define AT_WIRE_TIME_MS(n)          ((uint64_t)(n) * 10 * 1000 / at_get_baud())
+
+/* final result codes that end an AT response */
+enum at_final {
+    AT_FINAL_NONE = 0,      // no final result code yet (timeout)
+    AT_FINAL_OK,            // "OK"
+    AT_FINAL_ERROR,         // "ERROR"
+    AT_FINAL_CME_ERROR,     // "+CME ERROR: <err>" or "+CMS ERROR: <err>"
+    AT_FINAL_PROMPT,        // ">" data input prompt
+    AT_FINAL_DOWNLOAD,      // "DOWNLOAD" data input prompt
+    AT_FINAL_CONNECT        // "CONNECT [<rate>]", the UART now carries data (PPP)
+};
+
+typedef enum at_final eAtFinal;
+
+/* incremental line-oriented response parser */
+struct at_parser_t {
+    char line[AT_LINE_MAX];
+    size_t lineLen;
+    eAtFinal final;
+    const char* expect;     // URC prefix that must also arrive, NULL if none
+    bool expectSeen;
+};
+
+typedef struct at_parser_t at_parser_t;
+
+/* URC handler, runs on the I/O loop thread: must not send AT commands */
+typedef void (*at_urc_cb_t)(const char* line);
+
+/* completion callback of at_submit(), runs on the command thread: must not block */
+typedef void (*at_cmd_cb_t)(void* arg, int final, const char* resp);
+
+/**
+ * @brief   Reset parser state before a new response.
+ * @param   parser Pointer to parser.
+ * @param   expect URC prefix (e.g. "+CMQTTPUB:") that completes the command
+ *          together with the final result code; NULL if the final code is enough.
+ * @return  none.
+ */
+void at_parser_reset(at_parser_t* parser, const char* expect);
+
+/**
+ * @brief   Check whether the response is complete.
+ * @param   parser Pointer to parser.
+ * @return  true once the final result code and the expected URC (if any) arrived,
+ *          or an error result code arrived.
+ */
+bool at_parser_done(at_parser_t* parser);
+
+/**
+ * @brief   Feed received bytes to the parser.
+ * @param   parser Pointer to parser.
+ * @param   data Received bytes.
+ * @param   len Number of received bytes.
+ * @return  First final result code seen since reset; AT_FINAL_NONE if none yet.
+ */
+eAtFinal at_parser_feed(at_parser_t* parser, const char* data, size_t len);
+
+/**
+ * @brief   Queue an AT command without waiting for it.
+ *          Queued commands run back to back on the command thread,
+ *          after any blocking at_send_wait()/at_send_expect() call.
+ * @param   cmd Null-terminated AT command string, copied (< AT_ASYNC_CMD_LEN bytes).
+ * @param   expect URC prefix that completes the command, NULL if none.
+ * @param   timeout_ms Maximum time to wait for the response, in milliseconds.
+ * @param   cb Completion callback with the final result code and response; may be NULL.
+ * @param   arg Argument passed to cb.
+ * @return  0 if queued; -1 if the queue is full or cmd is too long.
+ */
+int at_submit(const char* cmd, const char* expect, uint64_t timeout_ms, at_cmd_cb_t cb, void* arg);
 
 /**
  * @brief   Send an AT command and wait for the response.
@@ -14,10 +97,34 @@
  * @param   recv_buf Pointer to buffer to store response message.
  * @param   len Length of the receive buffer.
  * @param   timeout_ms Maximum time to wait for the response, in milliseconds.
- * @return  0 on success (response received); -1 on error.
+ * @return  Final result code (eAtFinal, AT_FINAL_NONE on timeout); -1 on error.
  */
 int at_send_wait(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms);
 
+/**
+ * @brief   Send an AT command and wait for the final result code and a URC.
+ *          Used for commands that answer OK first and report the outcome later.
+ * @param   cmd Null-terminated AT command string (without newline).
+ * @param   recv_buf Pointer to buffer to store response message.
+ * @param   len Length of the receive buffer.
+ * @param   timeout_ms Maximum time to wait for the response, in milliseconds.
+ * @param   expect URC prefix to wait for (e.g. "+CMQTTPUB:"), NULL if none.
+ * @return  Final result code (eAtFinal, AT_FINAL_NONE on timeout); -1 on error.
+ */
+int at_send_expect(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms, const char* expect);
+
+/**
+ * @brief   Send the data of a '>' or DOWNLOAD prompt and wait for the response.
+ *          The data may hold any byte, NUL included; it is not logged.
+ * @param   data Pointer to the data to send.
+ * @param   data_len Number of bytes to send.
+ * @param   recv_buf Pointer to buffer to store response message.
+ * @param   len Length of the receive buffer.
+ * @param   timeout_ms Maximum time to wait for the response, in milliseconds.
+ * @return  Final result code (eAtFinal, AT_FINAL_NONE on timeout); -1 on error.
+ */
+int at_send_data(const void* data, size_t data_len, char* recv_buf, size_t len, uint64_t timeout_ms);
+
 /**
  * @brief   Send raw data over UART without waiting for a response.
  * @param   cmd Pointer to the data buffer to send.
@@ -27,13 +134,73 @@ int at_send_wait(char* cmd, char* recv_buf, size_t len, uint64_t timeout_ms);
 int at_send(char* cmd, size_t len);
 
 /**
- * @brief   Read data from UART with a timeout.
- * @param   buf Buffer to store the received data.
- * @param   max_len Maximum number of bytes to read.
- * @param   timeout_ms Maximum time to wait for data, in milliseconds.
- * @return  Number of bytes read; -1 on error.
+ * @brief   Register a handler for an unsolicited result code.
+ *          Lines starting with prefix go to the handler unless they belong to
+ *          the command that is currently waiting. Register before at_attach().
+ * @param   prefix URC prefix (e.g. "+CMQTTCONNLOST:").
+ * @param   cb Handler to call with the complete line.
+ * @return  0 on success; -1 if the handler table is full.
+ */
+int at_register_urc(const char* prefix, at_urc_cb_t cb);
+
+/**
+ * @brief   Split received bytes into lines and route them to the waiting
+ *          command or to the URC handlers.
+ * @param   data Received bytes.
+ * @param   len Number of received bytes.
+ * @return  none.
+ */
+void at_rx_bytes(const char* data, size_t len);
+
+/**
+ * @brief   Command thread, the only writer of AT commands to the SIM UART.
+ *          Blocking requests run first; after a '>' or DOWNLOAD prompt only
+ *          the blocking caller may send (its data) for up to AT_DATA_WAIT_MS.
+ * @param   arg Unused.
+ * @return  none.
+ */
+void* atCmdTask(void* arg);
+
+/**
+ * @brief   Read the SIM UART on an I/O loop, the only reader of the UART.
+ *          The UART is left alone while in data mode.
+ * @param   loop Event loop that owns the UART.
+ * @return  0 on success; -1 on error.
+ */
+int at_attach(evloop_t* loop);
+
+/**
+ * @brief   Check whether the UART was handed over to data mode by a CONNECT result.
+ *          AT commands fail right away while in data mode; at_send() still works.
+ * @return  true in data mode; false otherwise.
+ */
+bool at_in_data_mode(void);
+
+/**
+ * @brief   Take the UART back from data mode (after PPP ended), dropping unread input.
+ * @return  none.
+ */
+void at_leave_data_mode(void);
+
+/**
+ * @brief   Get the SIM UART device path given to sim_uart_init().
+ * @return  Device path, NULL before sim_uart_init().
+ */
+const char* at_get_uart_path(void);
+
+/**
+ * @brief   Change the local SIM UART baudrate. The modem side is changed with
+ *          AT+IPR; call only while no AT command is in flight.
+ * @param   baud Baudrate (9600, 19200, 38400, 57600, 115200, 230400, 460800 or 921600).
+ * @return  0 on success; -1 if the rate is not supported or termios fails.
+ */
+int at_set_baud(int baud);
+
+/**
+ * @brief   Get the current local SIM UART baudrate.
+ * @return  Baudrate in bit/s.
  */
-int at_read(char* buf, size_t max_len, uint64_t timeout_ms);
+int at_get_baud(void);
 
 /**
  * @brief   Initialize the UART interface for AT communication.
@@ -2,11 +2,18 @@
  * @file    sim.c
  * @brief   SIM state handlers for FSM control and state transition logic
  */
+#include <stdio.h>
+#include <stdbool.h>
 #include <unistd.h>
+#define LOG_MODULE          "SIM"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_SIM
 #include "sys/log.h"
+#include "sys/retry.h"
+#include "at.h"
 #include "sim_cmd.h"
 #include "sim.h"
 #include "fsm/fsm.h"
+#include "transport/mqtt.h"
 
 static const char* simStateStr[] = {
     "SIM_STATE_RESET",
@@ -16,42 +23,120 @@ static const char* simStateStr[] = {
     "SIM_STATE_PDP_ACTIVE"
 };
 
+/* set once the fast rate was tried, a failed attempt is not repeated */
+static bool baudNegotiated = false;
+
+/* set after the first AT sync, the warm start probe runs once per process */
+static bool warmProbed = false;
+
+/* retry delay and budget per state, indexed by eSimState; RESET retries forever */
+static backoff_t simBackoff[] = {
+    BACKOFF_INIT(500,  30000, 0),       // SIM_STATE_RESET
+    BACKOFF_INIT(500,  5000,  5),       // SIM_STATE_AT_SYNC
+    BACKOFF_INIT(1000, 10000, 10),      // SIM_STATE_SIM_READY
+    BACKOFF_INIT(1000, 30000, 30),      // SIM_STATE_NET_READY
+    BACKOFF_INIT(1000, 20000, 5)        // SIM_STATE_PDP_ACTIVE
+};
+
 static void updateSimState(eSimResult res, eSimState nextState)
 {
-    if (res == FAIL) {
-        setSimState(SIM_STATE_RESET);
-    } 
-    else if (res == PASS) {
-        if (getSimState() == SIM_STATE_PDP_ACTIVE) {
+    eSimState state = getSimState();
+    backoff_t* b = &simBackoff[state];
+
+    if (res == PASS) {
+        backoffReset(b);
+        if (state == SIM_STATE_PDP_ACTIVE) {
             setFsmLayer(FSM_LAYER_TRANSPORT);
             return;
         }
 
         setSimState(nextState);
-    } 
-    else {
-        sleep(1);
+        return;
     }
+
+    if (res == WAIT && !backoffExhausted(b)) {
+        fsmRetryAfter(backoffNext(b));
+        return;
+    }
+
+    /* start over from RESET; the failed state keeps its budget until it passes */
+    uint32_t delay = backoffNext(b);
+    LOG_WRN("%s failed (attempt %u) - reset in %u ms", simStateStr[state], b->attempt, delay);
+    fsmRetryAfter(delay);
+    setSimState(SIM_STATE_RESET);
 }
 
 static void simResetStatusHandler(void)
 {
-    while (1) {
-        if (simCheckAlive() == PASS)
-            break;
-        sleep(1);
+    eSimResult res = simCheckAlive();
+
+#if SIM_BAUD_NEGOTIATE
+    if (res != PASS) {
+        /* AT+IPR is kept by the modem, it may still run at the rate of a previous run */
+        at_set_baud(at_get_baud() == SIM_UART_BAUD_DEFAULT ? SIM_UART_BAUD_FAST : SIM_UART_BAUD_DEFAULT);
+        res = simCheckAlive();
     }
+#endif
 
-    updateSimState(PASS, SIM_STATE_AT_SYNC);
+    updateSimState((res == PASS) ? PASS : WAIT, SIM_STATE_AT_SYNC);
 } 
 
+/* after an application restart the modem may still be registered, attached and 
+   connected: skip what is already done */
+static void simWarmStart(void)
+{
+    eSimState next = SIM_STATE_SIM_READY;
+
+    if (simCheckReady() != PASS)
+        goto end;
+
+    next = SIM_STATE_NET_READY;
+    if (simCheckRegEps() != PASS)
+        goto end;
+
+    next = SIM_STATE_PDP_ACTIVE;
+    if (simCheckPdpActive() != PASS)
+        goto end;
+
+    LOG_INF("Warm start: PDP context already active");
+    setSimState(SIM_STATE_PDP_ACTIVE);
+    setFsmLayer(FSM_LAYER_TRANSPORT);
+
+    if (getTransportType() == TRANSPORT_MQTT)
+        mqttWarmStart();
+    return;
+
+end:
+    LOG_INF("Warm start: resume at %s", simStateStr[next]);
+    setSimState(next);
+}
+
 static void atSyncStatusHandler(void)
 {
     eSimResult res = PASS;
-    if (simCheckAlive() == FAIL || simEchoOff() == FAIL) {
+    if (simCheckAlive() == FAIL || simEchoOff() == FAIL || simEnableRegEpsUrc() == FAIL) {
         res = FAIL;
+        goto end;
+    }
+
+#if SIM_BAUD_NEGOTIATE
+    if (!baudNegotiated && at_get_baud() != SIM_UART_BAUD_FAST) {
+        baudNegotiated = true;
+        /* a failed switch leaves the link at the default rate, not an error */
+        if (simSetBaudRate(SIM_UART_BAUD_FAST) != PASS && simCheckAlive() != PASS)
+            res = FAIL;
     }
+#endif
 
+#if SIM_WARM_START
+    if (res == PASS && !warmProbed) {
+        warmProbed = true;
+        simWarmStart();
+        return;
+    }
+#endif
+
+end:
     updateSimState(res, SIM_STATE_SIM_READY);
 }
 
@@ -104,4 +189,26 @@ void simFsmHandler(eSimState state)
         pdpActiveStatusHandler();
         break;
     }
+}
+
+static void simRegEpsUrcHandler(const char* line)
+{
+    int stat = -1;
+    sscanf(line, "+CEREG: %d", &stat);
+
+    if (stat != 1 && stat != 5) {
+        LOG_WRN("EPS registration changed: %s", line);
+        fsmPostEvent(FSM_EVENT_NET_LOST);
+    }
+}
+
+static void simSmsUrcHandler(const char* line)
+{
+    LOG_INF("New SMS: %s", line);
+}
+
+void simRegisterUrcHandlers(void)
+{
+    at_register_urc("+CEREG:", simRegEpsUrcHandler);
+    at_register_urc("+CMTI:", simSmsUrcHandler);
 }
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include "sim_cmd.h"
 #include "fsm/fsm.h"
 
+#define SIM_STATUS_POLL_SEC     30
+#define SIM_BAUD_NEGOTIATE      1
+
+/* on the first AT sync, resume at the first state the modem has not completed */
+#define SIM_WARM_START          1
+
 /**
  * @brief Handle SIM layer FSM based on current SIM state.
  * @param state Current SIM state to be processed.
@@ -14,4 +20,10 @@
  */
 void simFsmHandler(eSimState state);
 
+/**
+ * @brief Register SIM layer URC handlers (registration changes, SMS).
+ * @return none.
+ */
+void simRegisterUrcHandlers(void);
+
 #endif
\ No newline at end of file
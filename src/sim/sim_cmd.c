@@ -2,7 +2,13 @@
  * @file    sim_cmd.c
  * @brief   High-level SIM API source file built on top of the AT command driver
  */
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#define LOG_MODULE          "SIM"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_SIM
 #include "sys/log.h"
 #include "at.h"
 #include "sim_cmd.h"
@@ -10,6 +16,55 @@
 
 static void mqttLogResult(eMqttResult res);
 
+static pthread_mutex_t statusLock = PTHREAD_MUTEX_INITIALIZER;
+static sim_status_t status = {
+    .rssi = 99,
+    .ber = 99,
+    .regStat = -1,
+    .ip = ""
+};
+
+/* topic currently held by the modem for each client index, "" if unknown */
+static char topicCache[MQTT_MAX_CLIENTS][TOPIC_PUB_MAX_LEN_BYTE + 1] = {0};
+static bool topicCacheOff = false;
+
+void mqttInvalidateTopic(int index)
+{
+    if (index >= 0 && index < MQTT_MAX_CLIENTS)
+        topicCache[index][0] = '\0';
+}
+
+void mqttDisableTopicCache(void)
+{
+    topicCacheOff = true;
+    for (int i = 0; i < MQTT_MAX_CLIENTS; i++)
+        topicCache[i][0] = '\0';
+}
+
+bool mqttTopicCached(int index, char* topic, int len)
+{
+#if MQTT_TOPIC_CACHE_ENABLE
+    if (topicCacheOff || index < 0 || index >= MQTT_MAX_CLIENTS || len > TOPIC_PUB_MAX_LEN_BYTE)
+        return false;
+
+    return (topicCache[index][0] != '\0' &&
+            strncmp(topicCache[index], topic, len) == 0 && 
+            topicCache[index][len] == '\0');
+#else
+    (void) index; (void) topic; (void) len;
+    return false;
+#endif
+}
+
+static void mqttCacheTopic(int index, char* topic, int len)
+{
+    if (index < 0 || index >= MQTT_MAX_CLIENTS || len > TOPIC_PUB_MAX_LEN_BYTE)
+        return;
+
+    memcpy(topicCache[index], topic, len);
+    topicCache[index][len] = '\0';
+}
+
 /* ===== BASIC AT ===== */
 
 int simEnterCmdMode(void)
@@ -22,11 +77,38 @@ int simEnterDataMode(void)
     return at_send(CMD_ENTER_DATA_MODE, strlen(CMD_ENTER_DATA_MODE));
 }
 
+eSimResult simDialPpp(void)
+{
+    char resp[RESP_FRAME] = {0};
+
+    int final = at_send_wait(AT_CMD_DIAL_PPP, resp, sizeof(resp), 10000);
+    if (final <= AT_FINAL_NONE)
+        return WAIT;
+
+    if (final == AT_FINAL_CONNECT)
+        return PASS;
+
+    return FAIL;
+}
+
+eSimResult simHangUp(void)
+{
+    char resp[RESP_FRAME] = {0};
+
+    if (at_send_wait(AT_CMD_HANG_UP, resp, sizeof(resp), 2000) <= AT_FINAL_NONE)
+        return WAIT;
+
+    if (strstr(resp, "OK"))
+        return PASS;
+
+    return FAIL;
+}
+
 eSimResult simCheckAlive(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_BASIC_CHECK, resp, sizeof(resp), 500) < 0)
+    if (at_send_wait(AT_CMD_BASIC_CHECK, resp, sizeof(resp), 500) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -39,7 +121,7 @@ eSimResult simEchoOn(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_ECHO_ON, resp, sizeof(resp), 500) < 0)
+    if (at_send_wait(AT_CMD_ECHO_ON, resp, sizeof(resp), 500) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -52,7 +134,7 @@ eSimResult simEchoOff(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_ECHO_OFF, resp, sizeof(resp), 500) < 0)
+    if (at_send_wait(AT_CMD_ECHO_OFF, resp, sizeof(resp), 500) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -61,11 +143,43 @@ eSimResult simEchoOff(void)
     return FAIL;
 }
 
+eSimResult simSetBaudRate(int baud)
+{
+    char resp[RESP_FRAME] = {0};
+    char cmd[CMD_LEN] = {0};
+    int oldBaud = at_get_baud();
+
+    snprintf(cmd, sizeof(cmd), AT_CMD_SET_BAUD, baud);
+
+    /* OK still comes back at the old rate, the modem switches right after */
+    if (at_send_wait(cmd, resp, sizeof(resp), 500) <= AT_FINAL_NONE)
+        return WAIT;
+
+    if (!strstr(resp, "OK"))
+        return FAIL;
+
+    if (at_set_baud(baud) < 0)
+        goto fallback;
+
+    for (int i = 0; i < 3; i++) {
+        usleep(100000);
+        if (simCheckAlive() == PASS) {
+            LOG_INF("Baudrate switched %d -> %d", oldBaud, baud);
+            return PASS;
+        }
+    }
+
+fallback:
+    LOG_WRN("No response at %d baud - fall back to %d", baud, SIM_UART_BAUD_DEFAULT);
+    at_set_baud(SIM_UART_BAUD_DEFAULT);
+    return FAIL;
+}
+
 eSimResult simCheckReady(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_CHECK_READY, resp, sizeof(resp), 1000) < 0)
+    if (at_send_wait(AT_CMD_CHECK_READY, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "CPIN: READY"))
@@ -78,7 +192,7 @@ eSimResult simCheckRegEps(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_CHECK_REG_EPS, resp, sizeof(resp), 1000) < 0)
+    if (at_send_wait(AT_CMD_CHECK_REG_EPS, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR"))
@@ -101,6 +215,87 @@ eSimResult simCheckRegEps(void)
     return WAIT;
 }
 
+eSimResult simEnableRegEpsUrc(void)
+{
+    char resp[RESP_FRAME] = {0};
+
+    if (at_send_wait(AT_CMD_ENABLE_REG_EPS_URC, resp, sizeof(resp), 500) <= AT_FINAL_NONE)
+        return WAIT;
+
+    if (strstr(resp, "OK"))
+        return PASS;
+
+    return FAIL;
+}
+
+static void simSignalCb(void* arg, int final, const char* resp)
+{
+    (void) arg;
+    int rssi = 99, ber = 99;
+    char* str = strstr(resp, "+CSQ:");
+
+    if (final != AT_FINAL_OK || str == NULL || sscanf(str, "+CSQ: %d,%d", &rssi, &ber) != 2)
+        return;
+
+    pthread_mutex_lock(&statusLock);
+    status.rssi = rssi;
+    status.ber = ber;
+    pthread_mutex_unlock(&statusLock);
+    LOG_INF("Signal: rssi=%d ber=%d", rssi, ber);
+}
+
+static void simRegCb(void* arg, int final, const char* resp)
+{
+    (void) arg;
+    int n = -1, stat = -1;
+    char* str = strstr(resp, "+CEREG:");
+
+    if (final != AT_FINAL_OK || str == NULL || sscanf(str, "+CEREG: %d,%d", &n, &stat) != 2)
+        return;
+
+    pthread_mutex_lock(&statusLock);
+    status.regStat = stat;
+    pthread_mutex_unlock(&statusLock);
+    LOG_INF("EPS registration: stat=%d", stat);
+}
+
+static void simIpCb(void* arg, int final, const char* resp)
+{
+    (void) arg;
+    int cid = -1;
+    char ip[sizeof(status.ip)] = {0};
+    char* str = strstr(resp, "+CGPADDR:");
+
+    if (final != AT_FINAL_OK || str == NULL || sscanf(str, "+CGPADDR: %d,%39[^\r\n]", &cid, ip) != 2)
+        return;
+
+    pthread_mutex_lock(&statusLock);
+    memcpy(status.ip, ip, sizeof(status.ip));
+    pthread_mutex_unlock(&statusLock);
+    LOG_INF("IP address: %s", ip);
+}
+
+int simPollStatusAsync(void)
+{
+    int queued = 0;
+
+    if (at_submit(AT_CMD_CHECK_SIGNAL, NULL, 1000, simSignalCb, NULL) == 0)
+        queued++;
+    if (at_submit(AT_CMD_CHECK_REG_EPS, NULL, 1000, simRegCb, NULL) == 0)
+        queued++;
+    if (at_submit(AT_CMD_GET_IP_ADDR, NULL, 1000, simIpCb, NULL) == 0)
+        queued++;
+
+    return queued;
+}
+
+void simGetStatus(sim_status_t* out)
+{
+    pthread_mutex_lock(&statusLock);
+    *out = status;
+    pthread_mutex_unlock(&statusLock);
+}
+
 eSimResult simSetPdpContext(void)
 {
 #if VIETTEL
@@ -115,7 +310,7 @@ eSimResult simSetPdpContext(void)
 
     snprintf(cmd, sizeof(cmd), AT_CMD_SET_PDP_CONTEXT, apn);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 1500) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 1500) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR"))
@@ -123,7 +318,7 @@ eSimResult simSetPdpContext(void)
 
     memset(resp, 0, sizeof(resp));
     
-    if (at_send_wait(AT_CMD_CHECK_PDP_CONTEXT, resp, sizeof(resp), 1000) < 0)
+    if (at_send_wait(AT_CMD_CHECK_PDP_CONTEXT, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, apn))
@@ -136,7 +331,7 @@ eSimResult simAttachGprs(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_ATTACH_GPRS, resp, sizeof(resp), 2000) < 0)
+    if (at_send_wait(AT_CMD_ATTACH_GPRS, resp, sizeof(resp), 2000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR"))    
@@ -144,7 +339,7 @@ eSimResult simAttachGprs(void)
     
     memset(resp, 0, sizeof(resp));
 
-    if (at_send_wait(AT_CMD_CHECK_ATTACH_GPRS, resp, sizeof(resp), 1000) < 0)
+    if (at_send_wait(AT_CMD_CHECK_ATTACH_GPRS, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "CGATT: 1"))
@@ -157,15 +352,20 @@ eSimResult simActivatePdp(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_ACTIVATE_PDP, resp, sizeof(resp), 2000) < 0)
+    if (at_send_wait(AT_CMD_ACTIVATE_PDP, resp, sizeof(resp), 2000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR"))    
         return FAIL;
-    
-    memset(resp, 0, sizeof(resp));
 
-    if (at_send_wait(AT_CMD_CHECK_PDP_ACTIVE, resp, sizeof(resp), 1000) < 0)
+    return simCheckPdpActive();
+}
+
+eSimResult simCheckPdpActive(void)
+{
+    char resp[RESP_FRAME] = {0};
+
+    if (at_send_wait(AT_CMD_CHECK_PDP_ACTIVE, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
         return WAIT;
 
     char* str = strstr(resp, "CGACT");
@@ -184,11 +384,33 @@ eSimResult simActivatePdp(void)
 
 /* ===== MQTT ===== */
 
+eSimResult mqttCheckConnected(int index)
+{
+    char resp[RESP_FRAME] = {0};
+    char want[24] = {0};
+
+    if (at_send_wait(AT_CMD_MQTT_CHECK_CONNECT, resp, sizeof(resp), 1000) <= AT_FINAL_NONE)
+        return WAIT;
+
+    if (strstr(resp, "ERROR"))
+        return FAIL;
+
+    /* connected clients are listed with their server: +CMQTTCONNECT: 0,"tcp://..." */
+    snprintf(want, sizeof(want), "+CMQTTCONNECT: %d,", index);
+    if (strstr(resp, want))
+        return PASS;
+
+    return FAIL;
+}
+
 eSimResult mqttStartService(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_MQTT_START, resp, sizeof(resp), 2000) < 0)
+    for (int i = 0; i < MQTT_MAX_CLIENTS; i++)
+        mqttInvalidateTopic(i);
+
+    if (at_send_expect(AT_CMD_MQTT_START, resp, sizeof(resp), 2000, "+CMQTTSTART:") <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR")) {
@@ -213,13 +435,15 @@ eSimResult mqttStartService(void)
 
 eSimResult mqttReleaseClient(int index)
 {
+    mqttInvalidateTopic(index);
+
     char resp[RESP_FRAME] = {0};
     char cmd[CMD_LEN] = {0};
     snprintf(cmd, sizeof(cmd), 
             AT_CMD_MQTT_RELEASE, 
             index);
     
-    if (at_send_wait(cmd, resp, sizeof(resp), 2000) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 2000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -243,13 +467,15 @@ eSimResult mqttReleaseClient(int index)
 
 eSimResult mqttAcquireClient(int index, char* id, int type)
 {
+    mqttInvalidateTopic(index);
+
     char resp[RESP_FRAME] = {0};
     char cmd[CMD_LEN] = {0};
     snprintf(cmd, sizeof(cmd), 
             AT_CMD_MQTT_ACQUIRE, 
             index, id, type);
     
-    if (at_send_wait(cmd, resp, sizeof(resp), 2000) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 2000) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))    
@@ -273,13 +499,15 @@ eSimResult mqttAcquireClient(int index, char* id, int type)
 
 eSimResult mqttDisconnect(int index, int timeout)
 {
+    mqttInvalidateTopic(index);
+
     char resp[RESP_FRAME] = {0};
     char cmd[CMD_LEN] = {0};
     snprintf(cmd, sizeof(cmd),
             AT_CMD_MQTT_DISCONNECT,
             index, timeout);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 2000) < 0)
+    if (at_send_expect(cmd, resp, sizeof(resp), 5000, "+CMQTTDISC:") <= AT_FINAL_NONE)
         return WAIT;
 
     char* str = strstr(resp, "CMQTTDISC");
@@ -300,6 +528,8 @@ eSimResult mqttDisconnect(int index, int timeout)
 
 eSimResult mqttConnect(mqttClient* cli, mqttServer* ser)
 {
+    mqttInvalidateTopic(cli->index);
+
     char resp[RESP_FRAME] = {0};
     char cmd[CMD_LEN] = {0};
     snprintf(cmd, sizeof(cmd),
@@ -307,7 +537,7 @@ eSimResult mqttConnect(mqttClient* cli, mqttServer* ser)
             cli->index, ser->addr, cli->keepAliveTime, 
             cli->cleanSession, cli->userName, cli->password);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 2000) < 0)
+    if (at_send_expect(cmd, resp, sizeof(resp), 10000, "+CMQTTCONNECT:") <= AT_FINAL_NONE)
         return WAIT;
 
     char* str = strstr(resp, "CMQTTCONNECT");
@@ -328,13 +558,18 @@ eSimResult mqttConnect(mqttClient* cli, mqttServer* ser)
 
 eSimResult mqttSetPublishTopic(int index, char* topic, int len)
 {
+    if (mqttTopicCached(index, topic, len))
+        return PASS;
+
+    mqttInvalidateTopic(index);
+
     char resp[RESP_FRAME] = {0};
     char cmd[CMD_LEN] = {0};
     snprintf(cmd, sizeof(cmd),
             AT_CMD_MQTT_TOPIC,
             index, len);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR")) {
@@ -359,11 +594,13 @@ eSimResult mqttSetPublishTopic(int index, char* topic, int len)
 
     memset(resp, 0, sizeof(resp));
 
-    if (at_send_wait(topic, resp, sizeof(resp), 150) < 0)
+    if (at_send_data(topic, len, resp, sizeof(resp), 150) <= AT_FINAL_NONE)
         return WAIT;
     
-    if (strstr(resp, "OK"))    
+    if (strstr(resp, "OK")) {
+        mqttCacheTopic(index, topic, len);
         return PASS; 
+    }
 
     return FAIL;
 }
@@ -376,7 +613,7 @@ eSimResult mqttSetPayload(int index, char* msg, int len)
             AT_CMD_MQTT_PAYLOAD,
             index, len);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR")) {
@@ -401,7 +638,7 @@ eSimResult mqttSetPayload(int index, char* msg, int len)
 
     memset(resp, 0, sizeof(resp));
 
-    if (at_send_wait(msg, resp, sizeof(resp), 150) < 0)
+    if (at_send_data(msg, len, resp, sizeof(resp), 150 + AT_WIRE_TIME_MS(len)) <= AT_FINAL_NONE)
         return WAIT;
     
     if (strstr(resp, "OK"))    
@@ -418,7 +655,7 @@ eSimResult mqttPublish(int index, int QoS, int pub_timeout)
             AT_CMD_MQTT_PUBLISH,
             index, QoS, pub_timeout);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_expect(cmd, resp, sizeof(resp), (uint64_t) pub_timeout * 1000, "+CMQTTPUB:") <= AT_FINAL_NONE)
         return WAIT;
 
     char* str = strstr(resp, "CMQTTPUB");
@@ -558,7 +795,7 @@ eSimResult httpStartService(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_HTTP_START, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(AT_CMD_HTTP_START, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -571,7 +808,7 @@ eSimResult httpStopService(void)
 {
     char resp[RESP_FRAME] = {0};
 
-    if (at_send_wait(AT_CMD_HTTP_STOP, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(AT_CMD_HTTP_STOP, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "ERROR") || strstr(resp, "OK")) 
@@ -586,7 +823,7 @@ eSimResult httpSetUrl(const char* url)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_URL, url);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -601,7 +838,7 @@ eSimResult httpSetContent(const char* content)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_CONTENT, content);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -616,7 +853,7 @@ eSimResult httpSetAccept(const char* acptType)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_ACCEPT, acptType);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -631,7 +868,7 @@ eSimResult httpSetConnectionTimeout(int timeout)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_CONN_TIMEOUT, timeout);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -646,7 +883,7 @@ eSimResult httpSetReceptionTimeout(int timeout)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_RECV_TIMEOUT, timeout);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -661,7 +898,7 @@ eSimResult httpSetSslContextId(int ctx_id)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_SSL, ctx_id);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -676,7 +913,7 @@ eSimResult httpSetCustomHeader(const char* header)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SET_USER_DATA, header);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (strstr(resp, "OK"))
@@ -693,7 +930,7 @@ eSimResult httpSendData(char* data, int len, int time)
             AT_CMD_HTTP_INPUT_DATA,
             len, time);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 200) < 0)
+    if (at_send_wait(cmd, resp, sizeof(resp), 200) <= AT_FINAL_NONE)
         return WAIT;
 
     if (!strstr(resp, "DOWNLOAD"))
@@ -701,7 +938,7 @@ eSimResult httpSendData(char* data, int len, int time)
 
     memset(resp, 0, sizeof(resp));
 
-    if (at_send_wait(data, resp, sizeof(resp), 200) < 0)
+    if (at_send_data(data, len, resp, sizeof(resp), 200 + AT_WIRE_TIME_MS(len)) <= AT_FINAL_NONE)
         return WAIT;
    
     if (strstr(resp, "OK"))
@@ -716,8 +953,20 @@ eSimResult httpSendAction(int method)
     char cmd[RESP_FRAME] = {0};
     snprintf(cmd, sizeof(cmd), AT_CMD_HTTP_SEND_ACTION, method);
 
-    if (at_send_wait(cmd, resp, sizeof(resp), 2000) < 0)
+    int final = at_send_expect(cmd, resp, sizeof(resp), 20000, "+HTTPACTION:");
+    if (final <= AT_FINAL_NONE)
         return WAIT;
 
+    /* +HTTPACTION: <method>,<status>,<datalen> */
+    int m = -1, code = -1, dataLen = 0;
+    char* str = strstr(resp, "+HTTPACTION:");
+    if (final != AT_FINAL_OK || str == NULL || sscanf(str, "+HTTPACTION: %d,%d,%d", &m, &code, &dataLen) < 2)
+        return FAIL;
+
+    if (code < 200 || code > 299) {
+        LOG_WRN("HTTP status %d", code);
+        return FAIL;
+    }
+
     return PASS;
 }
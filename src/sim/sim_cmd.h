@@ -27,7 +27,8 @@ enum sim_cmd_t {
 enum sim_result {
     PASS,
     WAIT,
-    FAIL
+    FAIL,
+    SKIP        // not attempted: the request itself is invalid, retrying cannot help
 };
 
 enum mqtt_result {
@@ -87,6 +88,14 @@ enum http_result{
     HTTP_RES_SERVICE_UNAVAILABLE = 503
 } ;
 
+/* link status refreshed by simPollStatusAsync() */
+typedef struct {
+    int rssi;           // AT+CSQ, 0..31, 99 = unknown
+    int ber;            // AT+CSQ, 0..7, 99 = unknown
+    int regStat;        // AT+CEREG?, -1 = unknown
+    char ip[40];        // AT+CGPADDR=1, "" = none
+} sim_status_t;
+
 typedef enum sim_cmd_t  eSimCmd;
 typedef enum sim_result eSimResult;
 typedef enum mqtt_result eMqttResult;
@@ -98,10 +107,12 @@ typedef enum http_result eHttpResult;
 #define AT_CMD_BASIC_CHECK          "AT\r\n"
 #define AT_CMD_ECHO_ON              "ATE1\r\n"
 #define AT_CMD_ECHO_OFF             "ATE0\r\n"
+#define AT_CMD_SET_BAUD             "AT+IPR=%d\r\n"
 #define AT_CMD_READ_ICCID           "AT+CICCID\r\n"
 #define AT_CMD_CHECK_READY          "AT+CPIN?\r\n"
 #define AT_CMD_CHECK_SIGNAL         "AT+CSQ\r\n"
 #define AT_CMD_CHECK_REG_EPS        "AT+CEREG?\r\n"
+#define AT_CMD_ENABLE_REG_EPS_URC   "AT+CEREG=1\r\n"
 #define AT_CMD_CHECK_PDP_CONTEXT    "AT+CGDCONT?\r\n"
 #define AT_CMD_SET_PDP_CONTEXT      "AT+CGDCONT=1,\"IP\",\"%s\"\r\n"   // APN
 #define AT_CMD_ATTACH_GPRS          "AT+CGATT=1\r\n"
@@ -111,6 +122,8 @@ typedef enum http_result eHttpResult;
 #define AT_CMD_DEACTIVATE_PDP       "AT+CGACT=0,1\r\n"
 #define AT_CMD_CHECK_PDP_ACTIVE     "AT+CGACT?\r\n"
 #define AT_CMD_GET_IP_ADDR          "AT+CGPADDR=1\r\n"
+#define AT_CMD_DIAL_PPP             "ATD*99#\r\n"
+#define AT_CMD_HANG_UP              "ATH\r\n"
 
 /* MQTT */
 #define AT_CMD_MQTT_START           "AT+CMQTTSTART\r\n"
@@ -119,6 +132,7 @@ typedef enum http_result eHttpResult;
 #define AT_CMD_MQTT_RELEASE         "AT+CMQTTREL=%d\r\n"
 #define AT_CMD_MQTT_SSL_CFG         "AT+CMQTTSSLCFG\r\n"
 #define AT_CMD_MQTT_CONNECT         "AT+CMQTTCONNECT=%d,\"%s\",%d,%d,\"%s\",\"%s\"\r\n"
+#define AT_CMD_MQTT_CHECK_CONNECT   "AT+CMQTTCONNECT?\r\n"
 #define AT_CMD_MQTT_DISCONNECT      "AT+CMQTTDISC=%d,%d\r\n"
 #define AT_CMD_MQTT_TOPIC           "AT+CMQTTTOPIC=%d,%d\r\n"
 #define AT_CMD_MQTT_PAYLOAD         "AT+CMQTTPAYLOAD=%d,%d\r\n"
@@ -154,6 +168,23 @@ int simEnterCmdMode(void);
  */
 int simEnterDataMode(void);
 
+/**
+ * @brief Dial the packet data service for PPP (ATD*99#). On CONNECT the
+ *        UART is handed over to PPP until at_leave_data_mode().
+ * @return PASS if CONNECT,
+ *         FAIL if the modem returns NO CARRIER/ERROR,
+ *         WAIT if command send failed or response not ready.
+ */
+eSimResult simDialPpp(void);
+
+/**
+ * @brief Hang up the data call (ATH), after leaving data mode with "+++".
+ * @return PASS if response OK,
+ *         FAIL if response ERROR,
+ *         WAIT if command cannot be sent or response is incomplete.
+ */
+eSimResult simHangUp(void);
+
 /**
  * @brief Check if the module is alive (AT → OK).
  * @return PASS if response OK,
@@ -178,6 +209,17 @@ eSimResult simEchoOn(void);
  */
 eSimResult simEchoOff(void);
 
+/**
+ * @brief Switch the modem and the local UART to a new baudrate (AT+IPR),
+ *        then verify the link with AT. The local UART falls back to
+ *        SIM_UART_BAUD_DEFAULT if the check fails.
+ * @param baud Target baudrate.
+ * @return PASS if the link works at baud,
+ *         FAIL if the modem rejected the rate or the link fell back,
+ *         WAIT if command send failed or response not ready.
+ */
+eSimResult simSetBaudRate(int baud);
+
 /**
  * @brief Check SIM card readiness (AT+CPIN?).
  * @return PASS if SIM is ready,
@@ -194,6 +236,28 @@ eSimResult simCheckReady(void);
  */
 eSimResult simCheckRegEps(void);
 
+/**
+ * @brief Enable unsolicited EPS registration reports (AT+CEREG=1).
+ * @return PASS if enabled,
+ *         FAIL if module returns error,
+ *         WAIT if command send failed or response not ready.
+ */
+eSimResult simEnableRegEpsUrc(void);
+
+/**
+ * @brief Queue the link status queries (AT+CSQ, AT+CEREG?, AT+CGPADDR=1) 
+ *        back to back without blocking the caller.
+ * @return Number of queries queued (0..3).
+ */
+int simPollStatusAsync(void);
+
+/**
+ * @brief Get the last link status reported by simPollStatusAsync().
+ * @param status Output status.
+ * @return none.
+ */
+void simGetStatus(sim_status_t* status);
+
 /**
  * @brief Set PDP context APN (AT+CGDCONT).
  * @return PASS if PDP context set successfully,
@@ -218,6 +282,14 @@ eSimResult simAttachGprs(void);
  */
 eSimResult simActivatePdp(void);
 
+/**
+ * @brief Check whether the PDP context is already active (AT+CGACT?).
+ * @return PASS if active,
+ *         FAIL if inactive,
+ *         WAIT if command send failed or response not ready.
+ */
+eSimResult simCheckPdpActive(void);
+
 /******************************************************************************/
 /* MQTT */
 /******************************************************************************/
@@ -270,8 +342,42 @@ eSimResult mqttConnect(mqttClient* cli, mqttServer* ser);
  */
 eSimResult mqttDisconnect(int index, int timeout);
 
+/**
+ * @brief Check whether a client is still connected to its server (AT+CMQTTCONNECT?).
+ * @param index Client index.
+ * @return PASS if connected,
+ *         FAIL if not connected or the MQTT service is stopped,
+ *         WAIT if command send failed or response not ready.
+ */
+eSimResult mqttCheckConnected(int index);
+
+/**
+ * @brief Forget the topic cached for a client, so the next
+ *        mqttSetPublishTopic() sends AT+CMQTTTOPIC again.
+ * @param index Client index.
+ * @return none.
+ */
+void mqttInvalidateTopic(int index);
+
+/**
+ * @brief Stop caching topics until restart, for modems that drop the topic
+ *        after every publish.
+ * @return none.
+ */
+void mqttDisableTopicCache(void);
+
+/**
+ * @brief Check whether mqttSetPublishTopic() would skip AT+CMQTTTOPIC for this topic.
+ * @param index Client index.
+ * @param topic Pointer to topic string.
+ * @param len Topic length.
+ * @return true if the topic is cached for the client.
+ */
+bool mqttTopicCached(int index, char* topic, int len);
+
 /**
  * @brief Set MQTT publish topic.
+ *        Returns PASS without AT traffic if the modem already holds this topic.
  * @param index Client index.
  * @param topic Pointer to topic string.
  * @param len Topic length.
@@ -387,10 +493,10 @@ eSimResult httpSetSslContextId(int ctx_id);
 eSimResult httpSetCustomHeader(const char* header);
 
 /**
- * @brief Send HTTP action (GET, POST, PUT, etc.).
+ * @brief Send HTTP action (GET, POST, PUT, etc.) and wait for +HTTPACTION.
  * @param method HTTP method identifier.
- * @return PASS if action executed successfully,
- *         FAIL if method is invalid or request failed,
+ * @return PASS if the server answered with a 2xx status,
+ *         FAIL if the request failed or the status is not 2xx,
  *         WAIT if command send failed or response not ready.
  */
 eSimResult httpSendAction(int method);
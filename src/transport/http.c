@@ -4,12 +4,18 @@
  */
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <pthread.h>
+#define LOG_MODULE          "NET"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_NET
 #include "sys/log.h"
 #include "sys/ringbuffer.h"
+#include "sys/retry.h"
 #include "sys/json.h"
+#include "sys/spool.h"
+#include "device_setup.h"
 #include "fsm/fsm.h"
 #include "sim/sim_cmd.h"
 #include "http.h"
@@ -21,14 +27,17 @@ static const char* httpStateStr[] = {
 };
 
 static http_ctx_t ctx = {0};
-static char data[RING_BUFFER_SIZE] = {0};
+static char data[HTTP_MAX_PAYLOAD_LEN + 1] = {0};
 static size_t dataLength = 0;
+static json_batch_t batch = {0};
+static uint64_t postStartMs = 0;
+static bool spoolPending = false;
+static bool batchOpen = false;
+static bool batchPending = false;       // finished live batch whose post failed
 bool isHttpFsmRunning = false;
 
-extern ring_buffer_t json_ring_buf;
-extern bool jsonReady;
-extern pthread_cond_t jsonCond;
-extern pthread_mutex_t jsonLock;
+extern ring_buffer_spsc_t json_ring_buf;
+extern spool_t spool;
 
 static void httpPrepareStatusHandler(void)
 {
@@ -69,22 +78,31 @@ end:
         setHttpState(HTTP_STATE_SEND);
 }
 
-static void httpSendStatusHandler(void)
+static eSimResult httpSendStatusHandler(void)
 {
+    eSimResult res = PASS;
+
     if (dataLength > HTTP_MAX_PAYLOAD_LEN) {
         LOG_WRN("Invalid JSON payload (%d bytes) - skip", dataLength);
         goto end;
     }
 
-    eSimResult res = httpSendData(data, dataLength, ctx.inputTimeout);
+    res = httpSendData(data, dataLength, ctx.inputTimeout);
 
     if (res != PASS) goto end;
 
-    httpSendAction(ctx.method);
+    res = httpSendAction(ctx.method);
 
 end:
-    memset(data, 0, dataLength);
+#if HTTP_SESSION_REUSE
+    if (res == PASS) {
+        /* session stays configured for the next batch */
+        setHttpState(HTTP_STATE_SEND);
+        return res;
+    }
+#endif
     setHttpState(HTTP_STATE_STOP);
+    return res;
 }
 
 static void httpStopStatusHandler(void)
@@ -93,50 +111,72 @@ static void httpStopStatusHandler(void)
     setHttpState(HTTP_STATE_PREPARE);
 }
 
-bool isReadyToUpload(void)
+void httpFsmHandler(eHttpState state)
 {
-    static int elapsedSeconds = 0;
-
-    elapsedSeconds++;
-
-    if (elapsedSeconds >= HTTP_POST_INTERVAL_SEC) {
-        elapsedSeconds = 0;
-        return true;
+    /* a failed session is torn down right away, not once the next batch is due */
+    if (state == HTTP_STATE_STOP) {
+        LOG_INF("%s", httpStateStr[state]);
+        httpStopStatusHandler();
+        return;
     }
 
-    return false;
-}
+    if (!isHttpFsmRunning && batchPending) {
+        LOG_INF("Retry batch of %d sample(s), %d bytes", batch.count, (int) dataLength);
+        isHttpFsmRunning = true;
+        postStartMs = retryNowMs();
+    }
+
+    if (!isHttpFsmRunning) {
+        if (!batchOpen) {
+            /* one POST carries every sample collected within the upload interval */
+#if PAYLOAD_BINARY_ENABLE
+            jsonBatchInitRaw(&batch, data, sizeof(data), PAYLOAD_DELTA_ENABLE);
+#else
+            jsonBatchInit(&batch, data, sizeof(data));
+#endif
+            /* samples spooled during an outage go first, oldest first */
+            spoolPending = spoolBacklog(&spool) && jsonBatchFromSpool(&batch, &spool, HTTP_BATCH_MAX_SAMPLES) > 0;
+            if (!spoolPending)
+                spoolCommit(&spool);    // only records skipped as corrupt, if any
+            batchOpen = true;
+        }
 
-void httpFsmHandler(eHttpState state)
-{
-    if (state == HTTP_STATE_PREPARE && !isHttpFsmRunning) {
-        pthread_mutex_lock(&jsonLock);
-        while (!jsonReady)
-            pthread_cond_wait(&jsonCond, &jsonLock);
-
-        getJsonData(&json_ring_buf, data);
-        dataLength = strlen(data);
-        jsonReady = false;
-        pthread_mutex_unlock(&jsonLock);
+        /* a posted event ends the wait and keeps the batch open for the next step */
+        json_wake_t wake = { .fds = { fsmEventFd() }, .count = 1, .timeoutMs = -1 };
+        if (!spoolPending && !jsonBatchCollect(&batch, &json_ring_buf, HTTP_BATCH_MAX_SAMPLES, HTTP_POST_INTERVAL_SEC * 1000, &wake))
+            return;
+
+        batchOpen = false;
+        dataLength = jsonBatchFinish(&batch);
+        LOG_INF("Upload batch of %d sample(s), %d bytes", batch.count, (int) dataLength);
         isHttpFsmRunning = true;
+        postStartMs = retryNowMs();
     }
 
-    if (!isHttpFsmRunning)
-        return;
-
     LOG_INF("%s", httpStateStr[state]);
     switch (state)
     {
     case HTTP_STATE_PREPARE:
         httpPrepareStatusHandler();
         break;
-    case HTTP_STATE_SEND:
-        httpSendStatusHandler();
-        break;
-    case HTTP_STATE_STOP:
-        httpStopStatusHandler();
+    case HTTP_STATE_SEND: {
+        /* the post of this batch is over, whether the session is kept or not */
+        eSimResult res = httpSendStatusHandler();
+        if (spoolPending) {
+            /* a spooled batch is read again from the spool */
+            if (res == PASS)
+                spoolCommit(&spool);
+            else
+                spoolRewind(&spool);
+            spoolPending = false;
+        } else {
+            /* a live batch is kept and posted again after STOP/PREPARE */
+            batchPending = (res != PASS);
+        }
         isHttpFsmRunning = false;
+        LOG_INF("HTTP post took %d ms", (int) (retryNowMs() - postStartMs));
         break;
+    }
     default:
         break;
     }
@@ -10,7 +10,11 @@
 #define     MAX_HEADER_LEN          256
 
 #define     HTTP_POST_INTERVAL_SEC  5
-#define     HTTP_MAX_PAYLOAD_LEN    50
+#define     HTTP_MAX_PAYLOAD_LEN    4096
+#define     HTTP_BATCH_MAX_SAMPLES  32
+
+/* keep HTTPINIT/HTTPPARA state across posts, tear down only on error */
+#define     HTTP_SESSION_REUSE      1
 
 enum connectionTimeout {
     HTTP_CONNECTION_TIMEOUT_20S = 20,
@@ -63,12 +67,6 @@ struct http_context_t
 
 typedef struct http_context_t http_ctx_t;
 
-/**
- * @brief Checks if the HTTP upload interval has elapsed.
- * @return true if ready to push to ring buffer & start http FSM, false otherwise.
- */
-bool isReadyToUpload(void);
-
 /**
  * @brief Handle HTTP finite state machine.
  * @param state Current HTTP FSM state.
@@ -4,11 +4,17 @@
  */
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <unistd.h>
-#include <pthread.h>
+#define LOG_MODULE          "NET"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_NET
 #include "sys/log.h"
 #include "sys/json.h"
+#include "sys/retry.h"
+#include "sys/spool.h"
+#include "device_setup.h"
 #include "ringbuffer.h"
+#include "sim/at.h"
 #include "sim/sim_cmd.h"
 #include "mqtt.h"
 #include "fsm/fsm.h"
@@ -27,29 +33,69 @@ static mqttPubMsg message = {0};
 
 static eMqttState preState = MQTT_STATE_RESET; 
 
-extern ring_buffer_t json_ring_buf;
-extern bool jsonReady;
-extern pthread_cond_t jsonCond;
-extern pthread_mutex_t jsonLock;
+static json_batch_t batch = {0};
+static char batchBuf[MESSAGE_MAX_LEN_BYTE + 1] = {0};
+/* finished live batch whose publish failed, sent again once READY */
+static bool batchPending = false;
+
+extern ring_buffer_spsc_t json_ring_buf;
+extern spool_t spool;
+
+/* retry delay and budget per state, indexed by eMqttState */
+static backoff_t mqttBackoff[] = {
+    BACKOFF_INIT(1000, 30000, 5),       // MQTT_STATE_RESET
+    BACKOFF_INIT(1000, 30000, 5),       // MQTT_STATE_START
+    BACKOFF_INIT(1000, 30000, 5),       // MQTT_STATE_ACCQ
+    BACKOFF_INIT(2000, 60000, 6),       // MQTT_STATE_CONNECT
+    BACKOFF_INIT(1000, 30000, 6)        // MQTT_STATE_READY
+};
+
+/* JSON array, or binary records back to back */
+static void mqttBatchReset(void)
+{
+    batchPending = false;
+#if PAYLOAD_BINARY_ENABLE
+    jsonBatchInitRaw(&batch, batchBuf, message.batchBytes + 1, PAYLOAD_DELTA_ENABLE);
+#else
+    jsonBatchInit(&batch, batchBuf, message.batchBytes + 1);
+#endif
+}
 
 static void updateMqttState(eSimResult res, eMqttState backState, eMqttState nextState)
 {
-    if (res == FAIL) {
-        if (getMqttState() == MQTT_STATE_START) {
-            setFsmLayer(FSM_LAYER_SIM);
-            return;
-        }
+    eMqttState state = getMqttState();
+    backoff_t* b = &mqttBackoff[state];
 
-        setMqttState(preState);
-        preState = backState;
-    } 
-    else if (res == PASS) {
-        preState = getMqttState();
+    if (res == PASS) {
+        backoffReset(b);
+        preState = state;
         setMqttState(nextState);
+        return;
+    }
+
+    uint32_t delay = backoffNext(b);
+    fsmRetryAfter(delay);
+
+    if (backoffExhausted(b)) {
+        /* out of retries: re-check the bearer before starting MQTT over;
+           the state keeps its budget (one try per cap) until it passes */
+        LOG_WRN("%s failed %u times - back to SIM layer in %u ms", mqttStateStr[state], b->attempt, delay);
+        preState = MQTT_STATE_RESET;
+        setMqttState(MQTT_STATE_RESET);
+        setFsmLayer(FSM_LAYER_SIM);
+        return;
     }
-    else {
-        sleep(1);
+
+    if (res == WAIT)
+        return;
+
+    if (state == MQTT_STATE_START) {
+        setFsmLayer(FSM_LAYER_SIM);
+        return;
     }
+
+    setMqttState(preState);
+    preState = backState;
 }
 
 static void mqttResetStatusHandler(void)
@@ -88,27 +134,102 @@ static void mqttConnectedStatusHandler(void)
     updateMqttState(res, MQTT_STATE_START, MQTT_STATE_READY);
 }
 
-static void mqttReadyStatusHandler(char* msg, int len)
+static eSimResult mqttPublishMessage(char* msg, int len)
 {
-    if (len > 100) {
-        LOG_WRN("Data package invalid (%d bytes) - skip", len);
-        return;
-    }
-
     eSimResult res = mqttSetPublishTopic(client.index, message.topic, message.topicLength);
     if (res != PASS)
-        goto end;
+        return res;
 
     res = mqttSetPayload(client.index, msg, len);
     if (res != PASS)
-        goto end;
-   
-    res = mqttPublish(client.index, message.qos, message.publishTimeout);
+        return res;
+
+    return mqttPublish(client.index, message.qos, message.publishTimeout);
+}
+
+/* PASS once published; SKIP if the payload can never be published, nothing sent */
+static eSimResult mqttReadyStatusHandler(char* msg, int len)
+{
+    if (len < MESSAGE_MIN_LEN_BYTE || len > MESSAGE_MAX_LEN_BYTE) {
+        LOG_WRN("Data package invalid (%d bytes) - skip", len);
+        return SKIP;
+    }
+
+    bool cached = mqttTopicCached(client.index, message.topic, message.topicLength);
+    eSimResult res = mqttPublishMessage(msg, len);
+
+    /* the modem did not keep the topic: set it and try once more; if that
+       works, this firmware clears it on every publish and the cache is no use */
+    if (res == FAIL && cached) {
+        LOG_WRN("Publish with cached topic failed - set topic again");
+        mqttInvalidateTopic(client.index);
+        res = mqttPublishMessage(msg, len);
+        if (res == PASS) {
+            LOG_WRN("Modem does not keep the publish topic - topic cache off");
+            mqttDisableTopicCache();
+        }
+    }
+
     if (res == PASS)
-        return;
+        return PASS;
 
-end:
+    mqttInvalidateTopic(client.index);
     updateMqttState(res, MQTT_STATE_ACCQ, MQTT_STATE_READY);
+    return res;
+}
+
+/* publish the finished live batch; keep it for the next READY step if that fails */
+static void mqttReadyBatchHandler(void)
+{
+    eSimResult res = (batch.count == 0) ? PASS : mqttReadyStatusHandler(batch.buf, batch.len);
+
+    if (res == SKIP)
+        LOG_ERR("Drop batch of %d sample(s) that cannot be published", batch.count);
+
+    if (res == PASS || res == SKIP) {
+        mqttBatchReset();
+        return;
+    }
+
+    if (!batchPending)
+        LOG_WRN("Publish failed - keep batch of %d sample(s) for retry", batch.count);
+    batchPending = true;
+}
+
+/* publish samples spooled during an outage, oldest first, before live ones */
+static void mqttReadySpoolHandler(void)
+{
+    eSimResult res = PASS;
+    int count = 1;
+
+    if (message.batchSamples <= 1) {
+        char msg[JSON_RECORD_MAX_LEN] = {0};
+        ssize_t len = spoolRead(&spool, msg, sizeof(msg));
+        if (len > 0)
+            res = mqttReadyStatusHandler(msg, len);
+    } else {
+        count = jsonBatchFromSpool(&batch, &spool, INT_MAX);
+        size_t len = jsonBatchFinish(&batch);
+        if (count > 0) {
+            LOG_INF("Publish spooled batch of %d sample(s), %d bytes", count, (int) len);
+            res = mqttReadyStatusHandler(batch.buf, len);
+        }
+        mqttBatchReset();
+    }
+
+    switch (res) {
+    case PASS:
+        spoolCommit(&spool);
+        break;
+    case SKIP:
+        /* sending it again can never work: drop it rather than block the spool */
+        LOG_ERR("Drop %d spooled sample(s) that cannot be published", count);
+        spoolCommit(&spool);
+        break;
+    default:
+        spoolRewind(&spool);
+        break;
+    }
 }
 
 void mqttClientInit(mqttClient* cli)
@@ -163,6 +284,29 @@ void mqttPublishMessageConfig(mqttPubMsg* msg)
     message.topicLength = msg->topicLength;
     message.qos = msg->qos;
     message.publishTimeout = msg->publishTimeout;
+
+    message.batchSamples = (msg->batchSamples > 1) ? msg->batchSamples : 1;
+    message.batchAgeMs = (msg->batchAgeMs > 0) ? msg->batchAgeMs : MQTT_BATCH_MAX_AGE_MS;
+
+    if (msg->batchBytes > JSON_RECORD_MAX_LEN && msg->batchBytes <= MESSAGE_MAX_LEN_BYTE)
+        message.batchBytes = msg->batchBytes;
+    else
+        message.batchBytes = MESSAGE_MAX_LEN_BYTE;
+
+    mqttBatchReset();
+}
+
+bool mqttWarmStart(void)
+{
+    if (mqttCheckConnected(client.index) != PASS)
+        return false;
+
+    /* the topic held by the modem is unknown, set it again on the first publish */
+    mqttInvalidateTopic(client.index);
+    preState = MQTT_STATE_CONNECT;
+    setMqttState(MQTT_STATE_READY);
+    LOG_INF("Warm start: MQTT client %d still connected", client.index);
+    return true;
 }
 
 void mqttFsmHandler(eMqttState state)
@@ -183,17 +327,58 @@ void mqttFsmHandler(eMqttState state)
         mqttConnectedStatusHandler();
         break;
     case MQTT_STATE_READY:
-        pthread_mutex_lock(&jsonLock);
-        while (!jsonReady)
-            pthread_cond_wait(&jsonCond, &jsonLock);
-
-        char msg[RING_BUFFER_SIZE] = {0};
-        getJsonData(&json_ring_buf, msg);
-        jsonReady = false;
-        pthread_mutex_unlock(&jsonLock);
-        mqttReadyStatusHandler(msg, strlen(msg));
+        /* oldest first: a failed live batch predates what was spooled since */
+        if (batchPending) {
+            LOG_INF("Publish kept batch of %d sample(s), %d bytes", batch.count, (int) batch.len);
+            mqttReadyBatchHandler();
+            break;
+        }
+
+        /* a batch left open by an FSM event is filled up first */
+        if (batch.count == 0 && spoolBacklog(&spool)) {
+            mqttReadySpoolHandler();
+            break;
+        }
+
+        /* a posted event ends the wait, fsmHandler() takes it before the next step */
+        json_wake_t wake = { .fds = { fsmEventFd() }, .count = 1, .timeoutMs = -1 };
+
+        if (message.batchSamples <= 1) {
+            if (!jsonWaitRecord(&json_ring_buf, &wake))
+                break;
+
+            char msg[JSON_RECORD_MAX_LEN] = {0};
+            size_t len = getJsonData(&json_ring_buf, msg, sizeof(msg));
+            if (len > 0 && mqttReadyStatusHandler(msg, len) != PASS && spoolAppend(&spool, msg, len) == 0)
+                LOG_WRN("Publish failed - sample spooled");
+            break;
+        }
+
+        if (!jsonBatchCollect(&batch, &json_ring_buf, message.batchSamples, message.batchAgeMs, &wake))
+            break;
+        jsonBatchFinish(&batch);
+        LOG_INF("Publish batch of %d sample(s), %d bytes", batch.count, (int) batch.len);
+        mqttReadyBatchHandler();
         break;
     default:
         break;
     }
+}
+
+static void mqttConnLostUrcHandler(const char* line)
+{
+    LOG_WRN("%s", line);
+    fsmPostEvent(FSM_EVENT_MQTT_CONN_LOST);
+}
+
+static void mqttNoNetUrcHandler(const char* line)
+{
+    LOG_WRN("%s", line);
+    fsmPostEvent(FSM_EVENT_NET_LOST);
+}
+
+void mqttRegisterUrcHandlers(void)
+{
+    at_register_urc("+CMQTTCONNLOST:", mqttConnLostUrcHandler);
+    at_register_urc("+CMQTTNONET", mqttNoNetUrcHandler);
 }
\ No newline at end of file
@@ -4,11 +4,13 @@
  */
 #ifndef _MQTT_H_
 #define _MQTT_H_
+#include <stdbool.h>
 #include "fsm/fsm.h"
 
 enum ClientIndex {
     FIRST,
-    SECOND
+    SECOND,
+    MQTT_MAX_CLIENTS
 };
 
 enum ServerType {
@@ -38,6 +40,9 @@ struct PublishMessageConfig {
     int topicLength;
     int qos;
     int publishTimeout;
+    int batchSamples;       // flush after this many samples, 1 = publish each sample alone
+    int batchBytes;         // flush before the JSON array exceeds this size
+    int batchAgeMs;         // flush when the oldest sample in the batch is this old
 };
 
 typedef struct ClientConfig mqttClient;
@@ -59,6 +64,13 @@ typedef struct PublishMessageConfig mqttPubMsg;
 #define     MESSAGE_MIN_LEN_BYTE        1
 #define     MESSAGE_MAX_LEN_BYTE        10240
 
+/* skip AT+CMQTTTOPIC when the modem already holds the topic; off by default,
+   SIMCom A76xx/SIM7600 firmware clears the topic after every AT+CMQTTPUB */
+#define     MQTT_TOPIC_CACHE_ENABLE     0
+
+#define     MQTT_BATCH_MAX_SAMPLES      10
+#define     MQTT_BATCH_MAX_AGE_MS       10000
+
 #define     MQTT_KEEPALIVE_30S          30
 #define     MQTT_KEEPALIVE_60S          60
 #define     MQTT_KEEPALIVE_120S         120
@@ -110,4 +122,17 @@ void mqttServerInit(mqttServer* ser);
  */
 void mqttPublishMessageConfig(mqttPubMsg* msg);
 
+/**
+ * @brief Resume at MQTT_STATE_READY if the modem kept the client connected
+ *        across an application restart (AT+CMQTTCONNECT?).
+ * @return true if the connection was reused; false if the FSM starts from RESET.
+ */
+bool mqttWarmStart(void);
+
+/**
+ * @brief Register MQTT URC handlers (connection lost, no network).
+ * @return none.
+ */
+void mqttRegisterUrcHandlers(void);
+
 #endif
\ No newline at end of file
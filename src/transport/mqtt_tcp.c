@@ -0,0 +1,442 @@
+/**
+ * @file    mqtt_tcp.c
+ * @brief   Minimal MQTT 3.1.1 client over a Linux TCP socket (used over PPP)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#define LOG_MODULE          "NET"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_NET
+#include "sys/log.h"
+#include "sys/retry.h"
+#include "mqtt_tcp.h"
+
+#define MQTT_PKT_CONNECT        0x10
+#define MQTT_PKT_CONNACK        0x20
+#define MQTT_PKT_PUBLISH        0x30
+#define MQTT_PKT_PUBACK         0x40
+#define MQTT_PKT_PINGREQ        0xC0
+#define MQTT_PKT_PINGRESP       0xD0
+#define MQTT_PKT_DISCONNECT     0xE0
+
+#define MQTT_PUBLISH_DUP        0x08
+
+static int mqtt_tcp_write(mqtt_tcp_t* c, const void* data, size_t len, int flags)
+{
+    const uint8_t* p = data;
+    size_t total = 0;
+
+    while (total < len) {
+        ssize_t ret = send(c->fd, p + total, len - total, flags | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERR("MQTT send failed: %s", strerror(errno));
+            return -1;
+        }
+        total += ret;
+    }
+
+    c->lastTxMs = retryNowMs();
+    return 0;
+}
+
+/* fixed header: packet type + remaining length (1..4 byte varint) */
+static size_t mqtt_put_header(uint8_t* out, uint8_t type, size_t remaining)
+{
+    size_t n = 0;
+    out[n++] = type;
+
+    do {
+        uint8_t b = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0)
+            b |= 0x80;
+        out[n++] = b;
+    } while (remaining > 0);
+
+    return n;
+}
+
+static size_t mqtt_put_string(uint8_t* out, const char* str)
+{
+    size_t len = strlen(str);
+    out[0] = len >> 8;
+    out[1] = len & 0xFF;
+    memcpy(out + 2, str, len);
+    return len + 2;
+}
+
+static int mqtt_send_publish(mqtt_tcp_t* c, const char* msg, size_t len, int qos, uint16_t id, bool dup)
+{
+    uint8_t hdr[8 + 2 + TOPIC_PUB_MAX_LEN_BYTE];
+    size_t topicLen = strlen(c->topic);
+    if (topicLen < TOPIC_PUB_MIN_LEN_BYTE || topicLen > TOPIC_PUB_MAX_LEN_BYTE) {
+        LOG_ERR("MQTT topic length %d out of range", (int) topicLen);
+        return -1;
+    }
+
+    size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + len;
+    uint8_t type = MQTT_PKT_PUBLISH | (qos << 1) | (dup ? MQTT_PUBLISH_DUP : 0);
+
+    size_t n = mqtt_put_header(hdr, type, remaining);
+    n += mqtt_put_string(hdr + n, c->topic);
+    if (qos > 0) {
+        hdr[n++] = id >> 8;
+        hdr[n++] = id & 0xFF;
+    }
+
+    /* header and payload leave in the same segment */
+    if (mqtt_tcp_write(c, hdr, n, MSG_MORE) < 0)
+        return -1;
+
+    return mqtt_tcp_write(c, msg, len, 0);
+}
+
+static void mqtt_handle_puback(mqtt_tcp_t* c, uint16_t id)
+{
+    for (int i = 0; i < MQTT_TCP_WINDOW; i++) {
+        if (c->inflight[i].used && c->inflight[i].id == id) {
+            c->inflight[i].used = false;
+            c->inflightCount--;
+            return;
+        }
+    }
+
+    LOG_WRN("PUBACK for unknown packet id %d", id);
+}
+
+/* parse complete packets from the receive buffer, return -1 on protocol error */
+static int mqtt_parse_rx(mqtt_tcp_t* c, bool* connack)
+{
+    while (c->rxLen >= 2) {
+        size_t remaining = 0;
+        size_t mult = 1;
+        size_t i = 1;
+
+        for (;;) {
+            if (i >= c->rxLen)
+                return 0;
+            if (i > 4)
+                return -1;
+            remaining += (c->rx[i] & 0x7F) * mult;
+            mult *= 128;
+            if ((c->rx[i++] & 0x80) == 0)
+                break;
+        }
+
+        if (i + remaining > sizeof(c->rx)) {
+            LOG_ERR("MQTT packet 0x%02X too large (%d bytes)", c->rx[0], (int) remaining);
+            return -1;
+        }
+
+        if (c->rxLen < i + remaining)
+            return 0;
+
+        uint8_t* body = c->rx + i;
+        switch (c->rx[0] & 0xF0) {
+        case MQTT_PKT_CONNACK:
+            if (remaining != 2 || body[1] != 0) {
+                LOG_ERR("MQTT connection refused: %d", remaining == 2 ? body[1] : -1);
+                return -1;
+            }
+            if (connack != NULL)
+                *connack = true;
+            break;
+        case MQTT_PKT_PUBACK:
+            if (remaining == 2)
+                mqtt_handle_puback(c, (body[0] << 8) | body[1]);
+            break;
+        case MQTT_PKT_PINGRESP:
+            c->pingPending = false;
+            break;
+        default:
+            LOG_WRN("Unexpected MQTT packet 0x%02X", c->rx[0]);
+            break;
+        }
+
+        c->rxLen -= i + remaining;
+        memmove(c->rx, c->rx + i + remaining, c->rxLen);
+    }
+
+    return 0;
+}
+
+static int mqtt_read(mqtt_tcp_t* c, int timeout_ms, bool* connack)
+{
+    struct pollfd pfd = {
+        .fd = c->fd,
+        .events = POLLIN
+    };
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return (errno == EINTR) ? 0 : -1;
+    if (ret == 0)
+        return 0;
+
+    ssize_t n = recv(c->fd, c->rx + c->rxLen, sizeof(c->rx) - c->rxLen, MSG_DONTWAIT);
+    if (n == 0) {
+        LOG_WRN("MQTT connection closed by broker");
+        return -1;
+    }
+    if (n < 0)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+    c->rxLen += n;
+    return mqtt_parse_rx(c, connack);
+}
+
+static int mqtt_open_socket(const char* addr)
+{
+    char host[SERVER_ADDR_MAX_LEN_BYTE] = {0};
+    char port[8] = "1883";
+
+    const char* p = strstr(addr, "://");
+    p = (p != NULL) ? p + 3 : addr;
+
+    const char* colon = strrchr(p, ':');
+    size_t hostLen = (colon != NULL) ? (size_t) (colon - p) : strlen(p);
+    if (hostLen == 0 || hostLen >= sizeof(host))
+        return -1;
+
+    memcpy(host, p, hostLen);
+    if (colon != NULL)
+        snprintf(port, sizeof(port), "%s", colon + 1);
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM
+    };
+    struct addrinfo* res = NULL;
+
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        LOG_ERR("Resolve %s failed: %s", host, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        /* bounds connect() and blocking sends */
+        struct timeval tv = {
+            .tv_sec = MQTT_TCP_CONNECT_TIMEOUT_MS / 1000,
+            .tv_usec = 0
+        };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    if (fd < 0)
+        LOG_ERR("Connect to %s:%s failed", host, port);
+
+    return fd;
+}
+
+void mqttTcpInit(mqtt_tcp_t* c, const char* topic)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    c->nextId = 1;
+    c->topic = topic;
+}
+
+int mqttTcpConnect(mqtt_tcp_t* c, const mqttClient* cli, const char* addr)
+{
+    uint8_t body[10 + 3 * (2 + SERVER_ADDR_MAX_LEN_BYTE)];
+    uint8_t pkt[5 + sizeof(body)];
+    size_t n = 0;
+
+    if (strlen(cli->ID) > SERVER_ADDR_MAX_LEN_BYTE ||
+    strlen(cli->userName) > SERVER_ADDR_MAX_LEN_BYTE ||
+    strlen(cli->password) > SERVER_ADDR_MAX_LEN_BYTE)
+        return -1;
+
+    mqttTcpClose(c);
+
+    c->fd = mqtt_open_socket(addr);
+    if (c->fd < 0)
+        return -1;
+
+    uint8_t flags = cli->cleanSession ? 0x02 : 0x00;
+    if (cli->userName[0] != '\0')
+        flags |= 0x80;
+    if (cli->password[0] != '\0')
+        flags |= 0x40;
+
+    n += mqtt_put_string(body + n, "MQTT");
+    body[n++] = 4;                      // protocol level 3.1.1
+    body[n++] = flags;
+    body[n++] = cli->keepAliveTime >> 8;
+    body[n++] = cli->keepAliveTime & 0xFF;
+    n += mqtt_put_string(body + n, cli->ID);
+    if (flags & 0x80)
+        n += mqtt_put_string(body + n, cli->userName);
+    if (flags & 0x40)
+        n += mqtt_put_string(body + n, cli->password);
+
+    size_t h = mqtt_put_header(pkt, MQTT_PKT_CONNECT, n);
+    memcpy(pkt + h, body, n);
+
+    if (mqtt_tcp_write(c, pkt, h + n, 0) < 0)
+        goto fail;
+
+    bool connack = false;
+    uint64_t deadline = retryNowMs() + MQTT_TCP_CONNECT_TIMEOUT_MS;
+    while (!connack) {
+        uint64_t now = retryNowMs();
+        if (now >= deadline) {
+            LOG_ERR("No CONNACK from %s", addr);
+            goto fail;
+        }
+        if (mqtt_read(c, deadline - now, &connack) < 0)
+            goto fail;
+    }
+
+    c->keepAlive = cli->keepAliveTime;
+    c->pingPending = false;
+
+    /* at-least-once: whatever was not acknowledged goes out again */
+    for (int i = 0; i < MQTT_TCP_WINDOW; i++) {
+        mqtt_tcp_inflight_t* m = &c->inflight[i];
+        if (m->used && mqtt_send_publish(c, m->payload, m->len, MQTT_QOS_1, m->id, true) < 0)
+            goto fail;
+    }
+
+    LOG_INF("MQTT connected to %s (%d publish(es) resent)", addr, c->inflightCount);
+    return 0;
+
+fail:
+    close(c->fd);
+    c->fd = -1;
+    c->rxLen = 0;
+    return -1;
+}
+
+int mqttTcpPublish(mqtt_tcp_t* c, const char* msg, size_t len, int qos, int timeout_ms)
+{
+    if (c->fd < 0 || len > MESSAGE_MAX_LEN_BYTE)
+        return -1;
+
+    if (qos <= MQTT_QOS_0)
+        return mqtt_send_publish(c, msg, len, MQTT_QOS_0, 0, false);
+
+    uint64_t deadline = retryNowMs() + timeout_ms;
+    while (c->inflightCount >= MQTT_TCP_WINDOW) {
+        uint64_t now = retryNowMs();
+        if (now >= deadline) {
+            LOG_WRN("MQTT window full - no PUBACK within %d ms", timeout_ms);
+            return -1;
+        }
+        if (mqttTcpPoll(c, deadline - now) < 0)
+            return -1;
+    }
+
+    mqtt_tcp_inflight_t* m = NULL;
+    for (int i = 0; i < MQTT_TCP_WINDOW; i++) {
+        if (!c->inflight[i].used) {
+            m = &c->inflight[i];
+            break;
+        }
+    }
+
+    m->used = true;
+    m->id = c->nextId;
+    m->len = len;
+    memcpy(m->payload, msg, len);
+    c->inflightCount++;
+
+    /* packet id 0 is not allowed */
+    c->nextId = (c->nextId == UINT16_MAX) ? 1 : c->nextId + 1;
+
+    /* the window owns the message now: a failed send is repeated after the reconnect */
+    if (mqtt_send_publish(c, m->payload, m->len, MQTT_QOS_1, m->id, false) < 0)
+        mqttTcpClose(c);
+
+    return m->id;
+}
+
+bool mqttTcpAcked(const mqtt_tcp_t* c, uint16_t id)
+{
+    for (int i = 0; i < MQTT_TCP_WINDOW; i++) {
+        if (c->inflight[i].used && c->inflight[i].id == id)
+            return false;
+    }
+
+    return true;
+}
+
+int mqttTcpPoll(mqtt_tcp_t* c, int timeout_ms)
+{
+    if (c->fd < 0)
+        return -1;
+
+    if (mqtt_read(c, timeout_ms, NULL) < 0)
+        return -1;
+
+    if (c->keepAlive <= 0)
+        return 0;
+
+    uint64_t idle = retryNowMs() - c->lastTxMs;
+    if (c->pingPending) {
+        if (idle >= (uint64_t) c->keepAlive * 1000) {
+            LOG_WRN("No PINGRESP within %d s", c->keepAlive);
+            return -1;
+        }
+    }
+    else if (idle >= (uint64_t) c->keepAlive * 1000 / 2) {
+        uint8_t ping[2] = {MQTT_PKT_PINGREQ, 0};
+        if (mqtt_tcp_write(c, ping, sizeof(ping), 0) < 0)
+            return -1;
+        c->pingPending = true;
+    }
+
+    return 0;
+}
+
+int mqttTcpKeepAliveMs(const mqtt_tcp_t* c)
+{
+    if (c->fd < 0 || c->keepAlive <= 0)
+        return -1;
+
+    /* PINGREQ after half the interval idle, PINGRESP within a whole one */
+    uint64_t due = (uint64_t) c->keepAlive * 1000 / (c->pingPending ? 1 : 2);
+    uint64_t idle = retryNowMs() - c->lastTxMs;
+
+    return (idle >= due) ? 0 : (int) (due - idle);
+}
+
+void mqttTcpClose(mqtt_tcp_t* c)
+{
+    if (c->fd < 0)
+        return;
+
+    uint8_t disc[2] = {MQTT_PKT_DISCONNECT, 0};
+    send(c->fd, disc, sizeof(disc), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    close(c->fd);
+    c->fd = -1;
+    c->rxLen = 0;
+    c->pingPending = false;
+}
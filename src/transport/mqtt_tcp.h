@@ -0,0 +1,102 @@
+/**
+ * @file    mqtt_tcp.h
+ * @brief   Minimal MQTT 3.1.1 client over a Linux TCP socket (used over PPP)
+ */
+#ifndef _MQTT_TCP_H_
+#define _MQTT_TCP_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mqtt.h"
+
+/* QoS 1 publishes sent before the oldest one must be acknowledged */
+#define     MQTT_TCP_WINDOW             8
+#define     MQTT_TCP_RX_BUF_LEN         256
+#define     MQTT_TCP_CONNECT_TIMEOUT_MS 10000
+
+/* unacknowledged QoS 1 publish, kept for resend after a reconnect */
+typedef struct {
+    bool used;
+    uint16_t id;
+    size_t len;
+    char payload[MESSAGE_MAX_LEN_BYTE];
+} mqtt_tcp_inflight_t;
+
+typedef struct {
+    int fd;
+    int keepAlive;                      // seconds, 0 = off
+    uint16_t nextId;
+    uint64_t lastTxMs;
+    bool pingPending;
+    uint8_t rx[MQTT_TCP_RX_BUF_LEN];
+    size_t rxLen;
+    const char* topic;
+    int inflightCount;
+    mqtt_tcp_inflight_t inflight[MQTT_TCP_WINDOW];
+} mqtt_tcp_t;
+
+/**
+ * @brief   Initialize a client, no connection is made.
+ * @param   c Client to initialize.
+ * @param   topic Publish topic, kept by reference.
+ * @return  none.
+ */
+void mqttTcpInit(mqtt_tcp_t* c, const char* topic);
+
+/**
+ * @brief   Open a TCP connection to the broker and send MQTT CONNECT.
+ *          Unacknowledged QoS 1 publishes are sent again with DUP set.
+ * @param   c Client.
+ * @param   cli Client ID, credentials, keep-alive and clean session flag.
+ * @param   addr Broker address, "tcp://host:port".
+ * @return  0 on CONNACK accepted; -1 otherwise.
+ */
+int mqttTcpConnect(mqtt_tcp_t* c, const mqttClient* cli, const char* addr);
+
+/**
+ * @brief   Publish a message without waiting for its PUBACK.
+ *          Blocks only while the QoS 1 window is full.
+ * @param   c Client.
+ * @param   msg Payload.
+ * @param   len Payload length (<= MESSAGE_MAX_LEN_BYTE).
+ * @param   qos MQTT_QOS_0 or MQTT_QOS_1.
+ * @param   timeout_ms Maximum time to wait for room in the window.
+ * @return  Packet id once taken into the QoS 1 window (a failed send then closes
+ *          the connection and is repeated after the reconnect); 0 once sent
+ *          with QoS 0; -1 if the message was not taken: not connected, send
+ *          failed (QoS 0), or the window stayed full.
+ */
+int mqttTcpPublish(mqtt_tcp_t* c, const char* msg, size_t len, int qos, int timeout_ms);
+
+/**
+ * @brief   Check whether the PUBACK of a QoS 1 publish arrived.
+ * @param   c Client.
+ * @param   id Packet id returned by mqttTcpPublish().
+ * @return  true if the id is no longer in the window.
+ */
+bool mqttTcpAcked(const mqtt_tcp_t* c, uint16_t id);
+
+/**
+ * @brief   Handle incoming packets (PUBACK, PINGRESP) and keep-alive.
+ * @param   c Client.
+ * @param   timeout_ms Time to wait for incoming data, 0 = do not wait.
+ * @return  0 on success; -1 if the connection failed.
+ */
+int mqttTcpPoll(mqtt_tcp_t* c, int timeout_ms);
+
+/**
+ * @brief   Time until mqttTcpPoll() has keep-alive work to do.
+ * @param   c Client.
+ * @return  Milliseconds, 0 if due now; -1 if keep-alive is off or not connected.
+ */
+int mqttTcpKeepAliveMs(const mqtt_tcp_t* c);
+
+/**
+ * @brief   Send MQTT DISCONNECT if connected and close the socket.
+ *          Unacknowledged publishes are kept.
+ * @param   c Client.
+ * @return  none.
+ */
+void mqttTcpClose(mqtt_tcp_t* c);
+
+#endif
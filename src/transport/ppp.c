@@ -0,0 +1,435 @@
+/**
+ * @file    ppp.c
+ * @brief   PPP state handlers: pppd over the SIM UART and MQTT from the Linux side
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#define LOG_MODULE          "NET"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_NET
+#include "sys/log.h"
+#include "sys/json.h"
+#include "sys/ringbuffer.h"
+#include "sys/retry.h"
+#include "sys/spool.h"
+#include "device_setup.h"
+#include "sim/at.h"
+#include "sim/sim_cmd.h"
+#include "mqtt_tcp.h"
+#include "ppp.h"
+#include "fsm/fsm.h"
+
+static const char* pppStateStr[] = {
+    "PPP_STATE_DIAL",
+    "PPP_STATE_LINK",
+    "PPP_STATE_CONNECT",
+    "PPP_STATE_READY",
+    "PPP_STATE_HANGUP"
+};
+
+static mqttClient client = {0};
+static mqttServer server = {0};
+static mqttPubMsg message = {0};
+
+static mqtt_tcp_t tcp;
+static pid_t pppdPid = -1;
+static uint64_t linkStartMs = 0;
+static backoff_t dialBackoff = BACKOFF_INIT(1000, 30000, 5);
+static backoff_t connectBackoff = BACKOFF_INIT(1000, 30000, PPP_CONNECT_MAX_RETRY);
+
+static json_batch_t batch = {0};
+static char batchBuf[MESSAGE_MAX_LEN_BYTE + 1] = {0};
+/* set once the batch is finished, until a publish takes it */
+static size_t pendingLen = 0;
+static int pendingCount = 0;
+
+/* spooled batches handed to the client, oldest first: the spool is committed
+   up to a batch only once it and every batch before it were acknowledged,
+   so a restart replays whatever only reached the in-RAM window */
+typedef struct {
+    uint16_t id;                // packet id, 0 once delivered (QoS 0, empty batch)
+    spool_pos_t end;
+} ppp_spooled_t;
+
+static ppp_spooled_t spooledQueue[MQTT_TCP_WINDOW];
+static int spooledHead = 0;
+static int spooledCount = 0;
+
+extern ring_buffer_spsc_t json_ring_buf;
+extern spool_t spool;
+
+/* JSON array, or binary records back to back */
+static void pppBatchReset(void)
+{
+#if PAYLOAD_BINARY_ENABLE
+    jsonBatchInitRaw(&batch, batchBuf, message.batchBytes + 1, PAYLOAD_DELTA_ENABLE);
+#else
+    jsonBatchInit(&batch, batchBuf, message.batchBytes + 1);
+#endif
+    pendingLen = 0;
+    pendingCount = 0;
+}
+
+static int pppdStart(void)
+{
+    char baud[16];
+    const char* dev = at_get_uart_path();
+
+    if (dev == NULL)
+        return -1;
+
+    snprintf(baud, sizeof(baud), "%d", at_get_baud());
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERR("fork failed");
+        return -1;
+    }
+
+    if (pid == 0) {
+        /* main() blocks the stop signals; pppd must still get pppdStop()'s SIGTERM */
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+
+        /* the modem already answered CONNECT, no chat script needed */
+        execl(PPPD_PATH, "pppd", dev, baud,
+            "nodetach", "noauth", "local", "nocrtscts",
+            "defaultroute", "usepeerdns", "noipdefault",
+            "lcp-echo-interval", "10", "lcp-echo-failure", "3",
+            (char*) NULL);
+        _exit(127);
+    }
+
+    pppdPid = pid;
+    LOG_INF("pppd started (pid %d) on %s at %s baud", (int) pid, dev, baud);
+    return 0;
+}
+
+static bool pppdAlive(void)
+{
+    if (pppdPid <= 0)
+        return false;
+
+    int status;
+    if (waitpid(pppdPid, &status, WNOHANG) == 0)
+        return true;
+
+    LOG_WRN("pppd exited (status %d)", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    pppdPid = -1;
+    return false;
+}
+
+static void pppdStop(void)
+{
+    if (!pppdAlive())
+        return;
+
+    kill(pppdPid, SIGTERM);
+    for (int i = 0; i < PPP_STOP_TIMEOUT_SEC * 10; i++) {
+        if (waitpid(pppdPid, NULL, WNOHANG) == pppdPid)
+            goto end;
+        usleep(100000);
+    }
+
+    LOG_WRN("pppd did not stop - kill");
+    kill(pppdPid, SIGKILL);
+    waitpid(pppdPid, NULL, 0);
+
+end:
+    pppdPid = -1;
+}
+
+static bool pppLinkUp(void)
+{
+    struct ifaddrs* list = NULL;
+    bool up = false;
+
+    if (getifaddrs(&list) < 0)
+        return false;
+
+    for (struct ifaddrs* ifa = list; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET &&
+            strcmp(ifa->ifa_name, PPP_IFNAME) == 0 && (ifa->ifa_flags & IFF_UP)) {
+            up = true;
+            break;
+        }
+    }
+
+    freeifaddrs(list);
+    return up;
+}
+
+static void pppDialStatusHandler(void)
+{
+    eSimResult res = simDialPpp();
+
+    if (res == WAIT && !backoffExhausted(&dialBackoff)) {
+        fsmRetryAfter(backoffNext(&dialBackoff));
+        return;
+    }
+
+    if (res != PASS) {
+        fsmRetryAfter(backoffNext(&dialBackoff));
+        LOG_WRN("PPP dial failed - back to SIM layer");
+        setFsmLayer(FSM_LAYER_SIM);
+        setSimState(SIM_STATE_NET_READY);
+        return;
+    }
+
+    if (pppdStart() < 0) {
+        setPppState(PPP_STATE_HANGUP);
+        return;
+    }
+
+    backoffReset(&dialBackoff);
+    linkStartMs = retryNowMs();
+    setPppState(PPP_STATE_LINK);
+}
+
+static void pppLinkStatusHandler(void)
+{
+    if (!pppdAlive()) {
+        setPppState(PPP_STATE_HANGUP);
+        return;
+    }
+
+    if (pppLinkUp()) {
+        LOG_INF("%s up after %d ms", PPP_IFNAME, (int) (retryNowMs() - linkStartMs));
+        setPppState(PPP_STATE_CONNECT);
+        return;
+    }
+
+    if (retryNowMs() - linkStartMs >= PPP_LINK_TIMEOUT_SEC * 1000) {
+        LOG_WRN("%s not up within %d s", PPP_IFNAME, PPP_LINK_TIMEOUT_SEC);
+        setPppState(PPP_STATE_HANGUP);
+        return;
+    }
+
+    fsmRetryAfter(PPP_LINK_POLL_MS);
+}
+
+static void pppConnectStatusHandler(void)
+{
+    if (!pppdAlive() || !pppLinkUp()) {
+        setPppState(PPP_STATE_HANGUP);
+        return;
+    }
+
+    if (mqttTcpConnect(&tcp, &client, server.addr) == 0) {
+        backoffReset(&connectBackoff);
+        setPppState(PPP_STATE_READY);
+        return;
+    }
+
+    uint32_t delay = backoffNext(&connectBackoff);
+    if (backoffExhausted(&connectBackoff)) {
+        LOG_WRN("MQTT connect failed %u times - restart PPP", connectBackoff.attempt);
+        backoffReset(&connectBackoff);
+        setPppState(PPP_STATE_HANGUP);
+        return;
+    }
+
+    fsmRetryAfter(delay);
+}
+
+static void pppSpooledPush(int id, spool_pos_t end)
+{
+    int tail = (spooledHead + spooledCount) % MQTT_TCP_WINDOW;
+    spooledQueue[tail] = (ppp_spooled_t) { .id = id, .end = end };
+    spooledCount++;
+}
+
+/* commit the spool past every leading batch that was acknowledged */
+static void pppSpooledAcked(void)
+{
+    while (spooledCount > 0) {
+        ppp_spooled_t* e = &spooledQueue[spooledHead];
+        if (e->id != 0 && !mqttTcpAcked(&tcp, e->id))
+            break;
+
+        spoolCommitTo(&spool, e->end);
+        spooledHead = (spooledHead + 1) % MQTT_TCP_WINDOW;
+        spooledCount--;
+    }
+}
+
+/* spooled records to send, with room to track one more batch */
+static bool pppSpoolReady(void)
+{
+    return spooledCount < MQTT_TCP_WINDOW && spoolReadable(&spool);
+}
+
+/* PUBACKs and keep-alive, without waiting */
+static int pppPoll(void)
+{
+    int ret = mqttTcpPoll(&tcp, 0);
+    pppSpooledAcked();
+    return ret;
+}
+
+/* fill the live batch; PUBACKs and keep-alive are served while waiting.
+   Returns 1 when the batch is due, 0 to step again (FSM event, or spooled
+   records to send first), -1 if the connection failed */
+static int pppCollect(void)
+{
+    while (1) {
+        json_wake_t wake = {
+            .fds = { fsmEventFd(), tcp.fd },
+            .count = 2,
+            .timeoutMs = mqttTcpKeepAliveMs(&tcp)
+        };
+
+        if (jsonBatchCollect(&batch, &json_ring_buf, message.batchSamples, message.batchAgeMs, &wake))
+            return 1;
+        if (pppPoll() < 0)
+            return -1;
+        /* fsmHandler() takes the event before the next step */
+        if (fsmEventPending())
+            return 0;
+        /* samples diverted to the spool while a spooled batch was unacknowledged */
+        if (batch.count == 0 && pppSpoolReady())
+            return 0;
+    }
+}
+
+static void pppReadyStatusHandler(void)
+{
+    bool spooled = false;
+    spool_pos_t spoolFrom;
+
+    /* a queued send that failed closed the socket */
+    if (tcp.fd < 0)
+        goto reconnect;
+
+    /* a finished batch that was not taken goes out again first */
+    if (pendingLen == 0) {
+        /* samples spooled during an outage go first, oldest first;
+           a batch left open by an FSM event is filled up before that */
+        spooled = (batch.count == 0 && pppSpoolReady());
+        if (spooled) {
+            spoolFrom = spoolTell(&spool);
+            jsonBatchFromSpool(&batch, &spool, (message.batchSamples > 1) ? INT_MAX : 1);
+        } else {
+            int ret = pppCollect();
+            if (ret < 0)
+                goto reconnect;     // the open batch is kept
+            if (ret == 0)
+                return;
+        }
+
+        pendingCount = batch.count;
+        pendingLen = jsonBatchFinish(&batch);
+    }
+
+    /* PUBACKs and keep-alive of earlier publishes */
+    if (pppPoll() < 0)
+        goto fail;
+
+    int id = 0;
+    if (pendingLen >= MESSAGE_MIN_LEN_BYTE && pendingCount > 0) {
+        LOG_INF("Publish batch of %d sample(s), %d bytes (%d in flight)",
+                pendingCount, (int) pendingLen, tcp.inflightCount);
+        id = mqttTcpPublish(&tcp, batch.buf, pendingLen, message.qos, message.publishTimeout * 1000);
+        if (id < 0)
+            goto fail;
+    }
+
+    /* a publish in the in-flight window is resent by the client itself */
+    if (spooled) {
+        pppSpooledPush(id, spoolTell(&spool));
+        pppSpooledAcked();
+    }
+    pppBatchReset();
+    return;
+
+fail:
+    /* a spooled batch is read again; a live one stays pending, also when
+       the window was full, and is published after the reconnect */
+    if (spooled) {
+        spoolSeek(&spool, spoolFrom);
+        pppBatchReset();
+    }
+reconnect:
+    /* unacknowledged QoS 1 publishes are resent after the reconnect */
+    mqttTcpClose(&tcp);
+    setPppState(PPP_STATE_CONNECT);
+}
+
+static void pppHangupStatusHandler(void)
+{
+    mqttTcpClose(&tcp);
+    pppdStop();
+
+    /* guard time around "+++" so the modem takes it as an escape */
+    at_leave_data_mode();
+    sleep(1);
+    simEnterCmdMode();
+    sleep(1);
+    simHangUp();
+
+    setPppState(PPP_STATE_DIAL);
+    setFsmLayer(FSM_LAYER_SIM);
+    setSimState(SIM_STATE_NET_READY);
+}
+
+void pppTransportInit(mqttClient* cli, mqttServer* ser, mqttPubMsg* msg)
+{
+    client = *cli;
+    if (client.ID == NULL)
+        client.ID = CLIENT_ID_DEFAULT;
+    if (client.userName == NULL)
+        client.userName = "";
+    if (client.password == NULL)
+        client.password = "";
+
+    server = *ser;
+    if (server.addr == NULL)
+        server.addr = SERVER_ADDR_DEFAULT;
+
+    message = *msg;
+    message.batchSamples = (msg->batchSamples > 1) ? msg->batchSamples : 1;
+    message.batchAgeMs = (msg->batchAgeMs > 0) ? msg->batchAgeMs : MQTT_BATCH_MAX_AGE_MS;
+
+    if (msg->batchBytes > JSON_RECORD_MAX_LEN && msg->batchBytes <= MESSAGE_MAX_LEN_BYTE)
+        message.batchBytes = msg->batchBytes;
+    else
+        message.batchBytes = MESSAGE_MAX_LEN_BYTE;
+
+    mqttTcpInit(&tcp, message.topic);
+    pppBatchReset();
+}
+
+void pppFsmHandler(ePppState state)
+{
+    LOG_INF("%s", pppStateStr[state]);
+    switch (state)
+    {
+    case PPP_STATE_DIAL:
+        pppDialStatusHandler();
+        break;
+    case PPP_STATE_LINK:
+        pppLinkStatusHandler();
+        break;
+    case PPP_STATE_CONNECT:
+        pppConnectStatusHandler();
+        break;
+    case PPP_STATE_READY:
+        pppReadyStatusHandler();
+        break;
+    case PPP_STATE_HANGUP:
+        pppHangupStatusHandler();
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * @file    ppp.h
+ * @brief   PPP state handlers: pppd over the SIM UART and MQTT from the Linux side
+ */
+#ifndef _PPP_H_
+#define _PPP_H_
+#include "fsm/fsm.h"
+#include "mqtt.h"
+
+#define     PPPD_PATH                   "/usr/sbin/pppd"
+#define     PPP_IFNAME                  "ppp0"
+
+#define     PPP_LINK_TIMEOUT_SEC        30
+#define     PPP_LINK_POLL_MS            500
+#define     PPP_CONNECT_MAX_RETRY       3
+#define     PPP_STOP_TIMEOUT_SEC        3
+
+/**
+ * @brief Handle PPP transport FSM based on current PPP state.
+ * @param state Current PPP state to be processed.
+ * @return none.
+ */
+void pppFsmHandler(ePppState state);
+
+/**
+ * @brief Set the MQTT client, broker and publish settings used over PPP.
+ *        Same settings as the AT-driven MQTT transport.
+ * @param cli MQTT client configuration.
+ * @param ser MQTT server configuration (addr "tcp://host:port").
+ * @param msg Publish message configuration.
+ * @return none.
+ */
+void pppTransportInit(mqttClient* cli, mqttServer* ser, mqttPubMsg* msg);
+
+#endif
@@ -5,6 +5,7 @@
  */
 #ifndef _TRANSPORT_CONFIG_H_
 #define _TRANSPORT_CONFIG_H_
+#include "device_setup.h"
 
 /* =====    MQTT    ===== */
 #define     MQTT_CLIENT_ID      "ENTER_CLIENT_ID"
@@ -19,6 +20,11 @@
 /* ===== HTTP ===== */
 #define     HTTP_SERVER_URL     "http://your_server.com/api"
 #define     HTTP_ACCEPT_TYPE    "application/json"
+/* binary records are not JSON; keep the header in step with the payload format */
+#if PAYLOAD_BINARY_ENABLE
+#define     HTTP_CONTENT_TYPE   "application/octet-stream"
+#else
 #define     HTTP_CONTENT_TYPE   "application/json"
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * @file    blog.h
+ * @brief   Binary log file format, shared by the logger and the host decoder
+ */
+#ifndef _BLOG_H_
+#define _BLOG_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/* A file is one or more sessions. A session starts with a header:
+ *   "BLOG"  u8 version  u64 start time (unix us)  u16 site count
+ *   per site: u16 id  u16 line  tag\0  fmt\0  file\0
+ * and continues with records:
+ *   u8 BLOG_REC  u16 id  u32 ms since start time  u8 args length  args
+ * The start time is when the logger started, the same in every session
+ * of a run, so that the records of a rotated segment keep their times.
+ * Integers are little-endian. Args follow the format string in order:
+ * integers, '*' widths and pointers as (zig-zag) varints, doubles as
+ * 8 raw bytes, strings as varint length + bytes. */
+#define BLOG_MAGIC              "BLOG"
+#define BLOG_VERSION            1
+#define BLOG_REC                0xB1
+#define BLOG_REC_HDR_LEN        8
+
+/* reserved site: the writer's "N line(s) dropped" notice, one varint arg */
+#define BLOG_ID_DROPPED         0xFFFF
+
+typedef enum {
+    BLOG_ARG_NONE,              // "%%" or end of format
+    BLOG_ARG_INT,
+    BLOG_ARG_UINT,
+    BLOG_ARG_DOUBLE,
+    BLOG_ARG_STR,
+    BLOG_ARG_PTR
+} eBlogArg;
+
+/* one conversion of a printf format */
+typedef struct {
+    const char* start;          // '%'
+    size_t len;                 // up to and including the conversion character
+    eBlogArg kind;
+    int stars;                  // '*' width/precision arguments before the value
+    int longs;                  // 0 int, 1 long, 2 long long or long double; 3 size_t/intmax_t/ptrdiff_t
+    char conv;
+} blog_spec_t;
+
+/**
+ * @brief   Find the next conversion in a printf format
+ * @param   fmt is format position to search from
+ * @param   spec is conversion found
+ * @return  format position after the conversion; NULL if there is none
+ */
+static inline const char* blogNextSpec(const char* fmt, blog_spec_t* spec)
+{
+    const char* p = fmt;
+
+    while ((p = __builtin_strchr(p, '%')) != NULL) {
+        spec->start = p++;
+        spec->stars = 0;
+        spec->longs = 0;
+
+        while (*p && __builtin_strchr("-+ #0", *p))
+            p++;
+        for (; *p == '*' || (*p >= '0' && *p <= '9') || *p == '.'; p++)
+            spec->stars += (*p == '*');
+
+        for (; *p && __builtin_strchr("hlLqjzt", *p); p++) {
+            if (*p == 'l')
+                spec->longs++;
+            else if (*p == 'L' || *p == 'q')
+                spec->longs = 2;
+            else if (*p == 'j' || *p == 'z' || *p == 't')
+                spec->longs = 3;
+        }
+
+        spec->conv = *p;
+        switch (*p) {
+        case 'd': case 'i': case 'c':
+            spec->kind = BLOG_ARG_INT;
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            spec->kind = BLOG_ARG_UINT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = BLOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->kind = BLOG_ARG_STR;
+            break;
+        case 'p':
+            spec->kind = BLOG_ARG_PTR;
+            break;
+        case '\0':
+            return NULL;
+        default:
+            spec->kind = BLOG_ARG_NONE;
+            break;
+        }
+
+        p++;
+        spec->len = p - spec->start;
+        return p;
+    }
+
+    return NULL;
+}
+
+#endif
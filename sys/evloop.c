@@ -0,0 +1,213 @@
+/**
+ * @file    evloop.c
+ * @brief   Single-threaded I/O event loop source file
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#define LOG_MODULE          "APP"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_APP
+#include "sys/log.h"
+#include "sys/evloop.h"
+
+/* epoll tags of the internal fds; device fds use their slot index */
+#define EVLOOP_TAG_WAKE         (EVLOOP_MAX_FDS + 0)
+#define EVLOOP_TAG_TIMER        (EVLOOP_MAX_FDS + 1)
+
+static bool evloopOnThread(evloop_t* loop)
+{
+    return atomic_load(&loop->running) && pthread_equal(loop->thread, pthread_self());
+}
+
+/* let a sleeping loop re-read its timers or stop flag */
+static void evloopWake(evloop_t* loop)
+{
+    uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) < 0) {
+        /* counter saturated; the loop is already due to wake up */
+    }
+}
+
+/* arm timerFd to the next expiry of the wheel; called with the lock held */
+static void evloopSetTimer(evloop_t* loop)
+{
+    struct itimerspec its = {0};
+    int64_t nextMs = timerWheelNextMs(&loop->wheel, retryNowMs());
+
+    if (nextMs >= 0) {
+        /* an all-zero value would disarm the timer */
+        if (nextMs == 0)
+            its.it_value.tv_nsec = 1000000;
+        else {
+            its.it_value.tv_sec = nextMs / 1000;
+            its.it_value.tv_nsec = (nextMs % 1000) * 1000000;
+        }
+    }
+
+    timerfd_settime(loop->timerFd, 0, &its, NULL);
+}
+
+int evloopInit(evloop_t* loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    loop->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    for (int i = 0; i < EVLOOP_MAX_FDS; i++)
+        loop->fds[i].fd = -1;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&loop->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    timerWheelInit(&loop->wheel, retryNowMs());
+
+    if (loop->epollFd < 0 || loop->timerFd < 0 || loop->wakeFd < 0)
+        goto fail;
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.u32 = EVLOOP_TAG_WAKE;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &ev) < 0)
+        goto fail;
+
+    ev.data.u32 = EVLOOP_TAG_TIMER;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->timerFd, &ev) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    LOG_ERR("Event loop init failed: %s", strerror(errno));
+    if (loop->epollFd >= 0)
+        close(loop->epollFd);
+    if (loop->timerFd >= 0)
+        close(loop->timerFd);
+    if (loop->wakeFd >= 0)
+        close(loop->wakeFd);
+    return -1;
+}
+
+int evloopAddFd(evloop_t* loop, int fd, evloop_fd_cb_t cb, void* arg)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&loop->lock);
+    for (int i = 0; i < EVLOOP_MAX_FDS; i++) {
+        if (loop->fds[i].fd >= 0)
+            continue;
+
+        struct epoll_event ev = { .events = EPOLLIN };
+        ev.data.u32 = i;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOG_ERR("epoll add fd %d failed: %s", fd, strerror(errno));
+            break;
+        }
+
+        loop->fds[i] = (evloop_fd_t) { fd, cb, arg };
+        ret = 0;
+        break;
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    return ret;
+}
+
+void evloopRemoveFd(evloop_t* loop, int fd)
+{
+    pthread_mutex_lock(&loop->lock);
+    for (int i = 0; i < EVLOOP_MAX_FDS; i++) {
+        if (loop->fds[i].fd == fd) {
+            epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+            loop->fds[i].fd = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loop->lock);
+}
+
+void evloopArm(evloop_t* loop, timer_entry_t* timer, uint32_t delayMs, timer_cb_t cb, void* arg)
+{
+    pthread_mutex_lock(&loop->lock);
+
+    /* the wheel only moves when the loop wakes up: count the delay from
+       the wheel's own tick, not from now */
+    uint64_t tickMs = loop->wheel.startMs + loop->wheel.tick * TIMER_WHEEL_TICK_MS;
+    uint64_t nowMs = retryNowMs();
+    if (nowMs > tickMs)
+        delayMs += nowMs - tickMs;
+
+    timerWheelArm(&loop->wheel, timer, delayMs, cb, arg);
+    evloopSetTimer(loop);
+    pthread_mutex_unlock(&loop->lock);
+
+    if (!evloopOnThread(loop))
+        evloopWake(loop);
+}
+
+void evloopCancel(evloop_t* loop, timer_entry_t* timer)
+{
+    pthread_mutex_lock(&loop->lock);
+    timerWheelCancel(&loop->wheel, timer);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+void evloopRun(evloop_t* loop)
+{
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    uint64_t cnt;
+
+    loop->thread = pthread_self();
+    atomic_store(&loop->running, true);
+
+    while (!atomic_load(&loop->stop)) {
+        int n = epoll_wait(loop->epollFd, events, EVLOOP_MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERR("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&loop->lock);
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+
+            if (tag == EVLOOP_TAG_WAKE) {
+                if (read(loop->wakeFd, &cnt, sizeof(cnt)) < 0) {
+                    /* already drained */
+                }
+            } else if (tag == EVLOOP_TAG_TIMER) {
+                if (read(loop->timerFd, &cnt, sizeof(cnt)) < 0) {
+                    /* re-armed since it fired */
+                }
+            } else if (tag < EVLOOP_MAX_FDS && loop->fds[tag].fd >= 0) {
+                /* a slot freed earlier in this batch is skipped */
+                evloop_fd_t* h = &loop->fds[tag];
+                h->cb(h->fd, h->arg);
+            }
+        }
+
+        timerWheelAdvance(&loop->wheel, retryNowMs());
+        evloopSetTimer(loop);
+        pthread_mutex_unlock(&loop->lock);
+    }
+
+    atomic_store(&loop->running, false);
+}
+
+void evloopStop(evloop_t* loop)
+{
+    atomic_store(&loop->stop, true);
+    evloopWake(loop);
+}
+
+void* evloopTask(void* arg)
+{
+    evloopRun((evloop_t*) arg);
+    return arg;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file    evloop.h
+ * @brief   Single-threaded I/O event loop: epoll for device fds, timerfd for timers
+ */
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sys/retry.h"
+
+#define EVLOOP_MAX_FDS          8
+#define EVLOOP_MAX_EVENTS       8
+
+/* readable fd; runs on the loop thread */
+typedef void (*evloop_fd_cb_t)(int fd, void* arg);
+
+typedef struct {
+    int fd;                     // -1 if the slot is free
+    evloop_fd_cb_t cb;
+    void* arg;
+} evloop_fd_t;
+
+/* Fd and timer callbacks run on the loop thread with the loop lock held,
+   so they may add/remove fds and arm/cancel timers. Other threads may do
+   the same; the loop picks the change up right away. */
+typedef struct {
+    int epollFd;
+    int timerFd;                // armed to the next expiry of the wheel
+    int wakeFd;                 // eventfd: timer changes and stop from other threads
+    pthread_mutex_t lock;       // recursive; guards fds and wheel
+    evloop_fd_t fds[EVLOOP_MAX_FDS];
+    timer_wheel_t wheel;
+    pthread_t thread;
+    atomic_bool running;
+    atomic_bool stop;
+} evloop_t;
+
+/**
+ * @brief   Create the epoll, timerfd and eventfd of a loop.
+ * @param   loop Event loop.
+ * @return  0 on success; -1 on error.
+ */
+int evloopInit(evloop_t* loop);
+
+/**
+ * @brief   Watch a non-blocking fd for input.
+ * @param   loop Event loop.
+ * @param   fd File descriptor.
+ * @param   cb Callback run when fd is readable (or hung up); it should read until EAGAIN.
+ * @param   arg Argument passed to cb.
+ * @return  0 on success; -1 if the table is full or epoll refuses the fd.
+ */
+int evloopAddFd(evloop_t* loop, int fd, evloop_fd_cb_t cb, void* arg);
+
+/**
+ * @brief   Stop watching an fd; no-op if it is not watched.
+ * @param   loop Event loop.
+ * @param   fd File descriptor.
+ * @return  none.
+ */
+void evloopRemoveFd(evloop_t* loop, int fd);
+
+/**
+ * @brief   Arm a timer on the loop wheel, re-arming it if it is already armed.
+ * @param   loop Event loop.
+ * @param   timer Timer entry, must stay valid while armed.
+ * @param   delayMs Delay from now, rounded up to TIMER_WHEEL_TICK_MS.
+ * @param   cb Callback run on the loop thread.
+ * @param   arg Argument passed to cb.
+ * @return  none.
+ */
+void evloopArm(evloop_t* loop, timer_entry_t* timer, uint32_t delayMs, timer_cb_t cb, void* arg);
+
+/**
+ * @brief   Cancel a timer; no-op if it is not armed.
+ * @param   loop Event loop.
+ * @param   timer Timer entry.
+ * @return  none.
+ */
+void evloopCancel(evloop_t* loop, timer_entry_t* timer);
+
+/**
+ * @brief   Run the loop on the calling thread until evloopStop().
+ * @param   loop Event loop.
+ * @return  none.
+ */
+void evloopRun(evloop_t* loop);
+
+/**
+ * @brief   Make evloopRun() return after the current callbacks.
+ * @param   loop Event loop.
+ * @return  none.
+ */
+void evloopStop(evloop_t* loop);
+
+/**
+ * @brief   Thread entry that runs a loop.
+ * @param   arg Event loop.
+ * @return  arg.
+ */
+void* evloopTask(void* arg);
+
+#endif
@@ -4,26 +4,286 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
 #include "sys/ringbuffer.h"
+#include "sys/spool.h"
+#include "sys/payload.h"
+#include "sys/retry.h"
 #include "sys/json.h"
 
-void getJsonData(ring_buffer_t* rb, char* buf) 
+size_t getJsonData(ring_buffer_spsc_t* rb, char* buf, size_t len) 
 {
-    ring_buffer_size_t ring_buf_size = ring_buffer_num_items(rb);
-    ring_buffer_dequeue_arr(rb, buf, ring_buf_size);
+    size_t n = ring_buffer_pop_record(rb, buf, len - 1);
+
+    /* a cut-off record is no valid sample, drop it */
+    if (n > len - 1)
+        n = 0;
+
+    buf[n] = '\0';
+    return n;
+}
+
+static const char digitPairs[] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+static const uint64_t pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+
+/* write v in decimal, two digits per step from the end */
+static char* putUint(char* p, uint64_t v)
+{
+    char tmp[20];
+    char* q = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        q -= 2;
+        memcpy(q, &digitPairs[(v % 100) * 2], 2);
+        v /= 100;
+    }
+
+    if (v >= 10) {
+        q -= 2;
+        memcpy(q, &digitPairs[v * 2], 2);
+    } else {
+        *--q = '0' + v;
+    }
+
+    size_t n = tmp + sizeof(tmp) - q;
+    memcpy(p, q, n);
+    return p + n;
+}
+
+/* write v / 10^decimals with exactly decimals digits after the point */
+static char* putFixed(char* p, int64_t v, int decimals)
+{
+    uint64_t u = (v < 0) ? -(uint64_t) v : (uint64_t) v;
+
+    if (v < 0)
+        *p++ = '-';
+
+    p = putUint(p, u / pow10[decimals]);
+    *p++ = '.';
+
+    uint64_t frac = u % pow10[decimals];
+    for (int i = decimals - 1; i >= 0; i--) {
+        p[i] = '0' + frac % 10;
+        frac /= 10;
+    }
+
+    return p + decimals;
+}
+
+static char* putStr(char* p, const char* s, size_t n)
+{
+    memcpy(p, s, n);
+    return p + n;
+}
+
+#define PUT_LITERAL(p, s)   putStr(p, s, sizeof(s) - 1)
+
+/* v is already scaled by 10^decimals; NaN (no fix, failed read), infinity
+   and values beyond int64 have no JSON number and come out as null */
+static char* putScaled(char* p, double v, int decimals)
+{
+    if (!isfinite(v) || fabs(v) >= 9.2e18)
+        return PUT_LITERAL(p, "null");
+
+    return putFixed(p, llround(v), decimals);
+}
+
+size_t formatJsonData(char* buf, size_t len, double lat, double lng, double alt, uint32_t pm25, float aqi)
+{
+    if (len < JSON_SAMPLE_MAX_LEN)
+        return 0;
+
+    char* p = buf;
+    p = PUT_LITERAL(p, "{\"lat\":");
+    p = putScaled(p, lat * 1e7, 7);
+    p = PUT_LITERAL(p, ",\"lng\":");
+    p = putScaled(p, lng * 1e7, 7);
+    p = PUT_LITERAL(p, ",\"alt\":");
+    p = putScaled(p, alt * 100, 2);
+    p = PUT_LITERAL(p, ",\"pm2_5\":");
+    p = putUint(p, pm25);
+    p = PUT_LITERAL(p, ",\"aqi\":");
+    p = putScaled(p, aqi * 10, 1);
+    *p++ = '}';
+    *p = '\0';
+
+    return p - buf;
+}
+
+void jsonBatchInit(json_batch_t* batch, char* buf, size_t size)
+{
+    batch->buf = buf;
+    batch->size = size;
+    batch->len = 1;
+    batch->count = 0;
+    batch->startMs = 0;
+    batch->raw = false;
+    batch->delta = false;
+    buf[0] = '[';
+    buf[1] = '\0';
+}
+
+void jsonBatchInitRaw(json_batch_t* batch, char* buf, size_t size, bool delta)
+{
+    batch->buf = buf;
+    batch->size = size;
+    batch->len = 0;
+    batch->count = 0;
+    batch->startMs = 0;
+    batch->raw = true;
+    batch->delta = delta;
+    buf[0] = '\0';
 }
 
-void parseAllDataToJson(ring_buffer_t* rb, float lat, float lng, float alt, uint32_t pm25, float aqi)
+size_t jsonBatchRoom(json_batch_t* batch)
 {
-    char json_buf[256] = {0};
+    /* keep space for ',' separator, closing ']' and null terminator */
+    size_t reserved = batch->len + 3;
+    if (reserved >= batch->size)
+        return 0;
 
-    snprintf(json_buf, sizeof(json_buf),
-        "{\"lat\":%f,"
-        "\"lng\":%f,"
-        "\"alt\":%f,"
-        "\"pm2_5\":%d,"
-        "\"aqi\":%f}",
-        lat, lng, alt, pm25, aqi);
+    return batch->size - reserved;
+}
+
+int jsonBatchAppend(json_batch_t* batch, const char* rec, size_t len)
+{
+    if (len > jsonBatchRoom(batch))
+        return -1;
+
+    if (batch->count > 0 && !batch->raw)
+        batch->buf[batch->len++] = ',';
+
+    memcpy(batch->buf + batch->len, rec, len);
+    batch->len += len;
+    batch->buf[batch->len] = '\0';
+    batch->count++;
+    return 0;
+}
+
+/* 1 if a record is available, 0 on timeout, -1 if a wake fd is readable;
+   wake fds are checked even while records are queued */
+static int jsonWait(ring_buffer_spsc_t* rb, int timeoutMs, const json_wake_t* wake)
+{
+    struct pollfd pfd[1 + JSON_WAKE_MAX_FDS];
+    int n = 0;
+
+    pfd[n++] = (struct pollfd) { .fd = rb->event_fd, .events = POLLIN };
+    for (int i = 0; wake != NULL && i < wake->count && i < JSON_WAKE_MAX_FDS; i++)
+        pfd[n++] = (struct pollfd) { .fd = wake->fds[i], .events = POLLIN };
+
+    while (1) {
+        bool queued = ring_buffer_spsc_num_items(rb) > 0;
+
+        /* the ring eventfd is sticky, a record queued before poll() is not missed */
+        int ret = poll(pfd, n, queued ? 0 : timeoutMs);
+        for (int i = 1; ret > 0 && i < n; i++) {
+            if (pfd[i].revents)
+                return -1;
+        }
+
+        if (queued)
+            return 1;
+        if (ret == 0)
+            return 0;
+
+        uint64_t cnt;
+        if (ret > 0 && read(rb->event_fd, &cnt, sizeof(cnt)) < 0) {
+            /* already drained by an earlier wake-up */
+        }
+    }
+}
+
+bool jsonWaitRecord(ring_buffer_spsc_t* rb, const json_wake_t* wake)
+{
+    return jsonWait(rb, (wake != NULL) ? wake->timeoutMs : -1, wake) > 0;
+}
+
+bool jsonBatchCollect(json_batch_t* batch, ring_buffer_spsc_t* rb, int maxCount, int maxAgeMs, const json_wake_t* wake)
+{
+    char rec[JSON_RECORD_MAX_LEN] = {0};
+
+    while (batch->count < maxCount) {
+        if (jsonBatchRoom(batch) == 0)
+            break;
+
+        int timeout = (wake != NULL) ? wake->timeoutMs : -1;
+        bool ageBound = false;
+        if (batch->count > 0) {
+            uint64_t age = retryNowMs() - batch->startMs;
+            if (age >= (uint64_t) maxAgeMs)
+                break;
+            if (timeout < 0 || (uint64_t) timeout >= maxAgeMs - age) {
+                timeout = maxAgeMs - age;
+                ageBound = true;
+            }
+        }
+
+        int ret = jsonWait(rb, timeout, wake);
+        if (ret == 0 && ageBound)
+            break;
+        if (ret <= 0)
+            return false;
+
+        /* near the end, a record that does not fit is left for the next batch */
+        if (batch->count > 0 && jsonBatchRoom(batch) < sizeof(rec) - 1 &&
+            ring_buffer_peek_record(rb, rec, sizeof(rec) - 1) > jsonBatchRoom(batch))
+            break;
+
+        size_t len = getJsonData(rb, rec, sizeof(rec));
+        if (len == 0)
+            continue;
+
+        if (batch->count == 0)
+            batch->startMs = retryNowMs();
+        jsonBatchAppend(batch, rec, len);
+    }
+
+    return true;
+}
+
+int jsonBatchFromSpool(json_batch_t* batch, spool_t* spool, int maxCount)
+{
+    char rec[JSON_RECORD_MAX_LEN] = {0};
+
+    while (batch->count < maxCount) {
+        ssize_t len = spoolRead(spool, rec, sizeof(rec));
+        if (len <= 0)
+            break;
+
+        /* a record that does not fit starts the next batch; one that
+           does not fit an empty batch never will and is dropped */
+        if ((size_t) len > jsonBatchRoom(batch)) {
+            if (batch->count == 0)
+                continue;
+            spoolUnread(spool);
+            break;
+        }
+
+        if (batch->count == 0)
+            batch->startMs = retryNowMs();
+        jsonBatchAppend(batch, rec, len);
+    }
+
+    return batch->count;
+}
+
+size_t jsonBatchFinish(json_batch_t* batch)
+{
+    if (batch->raw && batch->delta)
+        batch->len = payloadDeltaBatch((uint8_t*) batch->buf, batch->len);
+    if (batch->raw)
+        return batch->len;
 
-    ring_buffer_queue_arr(rb, json_buf, strlen(json_buf));
+    batch->buf[batch->len++] = ']';
+    batch->buf[batch->len] = '\0';
+    return batch->len;
 }
\ No newline at end of file
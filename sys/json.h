@@ -4,25 +4,139 @@
  */
 #ifndef _JSON_H_
 #define _JSON_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "sys/ringbuffer.h"
+#include "sys/spool.h"
+
+/* maximum length of one JSON sample record */
+#define JSON_RECORD_MAX_LEN     256
+
+/* buffer size formatJsonData() needs: keys, five numbers at full width and null */
+#define JSON_SAMPLE_MAX_LEN     160
+
+/* most fds besides the ring that can end a wait for samples */
+#define JSON_WAKE_MAX_FDS       2
+
+/* what ends a wait for samples early: any of fds readable, or timeoutMs
+   without a record (-1: no limit) */
+typedef struct {
+    int fds[JSON_WAKE_MAX_FDS];
+    int count;
+    int timeoutMs;
+} json_wake_t;
+
+/* JSON array of samples built in a caller-owned buffer,
+   or records back to back when raw (binary payload), delta coded if delta */
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    int count;
+    uint64_t startMs;
+    bool raw;
+    bool delta;
+} json_batch_t;
 
 /**
- * @brief   Get JSON data from ring buffer 
+ * @brief   Get the oldest JSON record from ring buffer (consumer side)
  * @param   rb is ring buffer address to get data from
- * @param   buf is buffer address to store data
- * @return  none
+ * @param   buf is buffer address to store the null-terminated record
+ * @param   len is size of buf
+ * @return  length of the record; 0 if there is none, or it did not fit buf (dropped)
  */
-void getJsonData(ring_buffer_t* rb, char* buf); 
+size_t getJsonData(ring_buffer_spsc_t* rb, char* buf, size_t len); 
 
- /**
- * @brief   Format data to JSON string and store into ring buffer
- * @param   rb Address of ring buffer to store the JSON string
- * @param   key Site identifier string (e.g., "us" or "hs")
- * @param   row Calculated row index
- * @param   col Calculated column index
+/**
+ * @brief   Format one sample as a JSON record, straight into buf.
+ *          Fixed-point output: lat/lng with 7 decimals, alt with 2, aqi with 1;
+ *          NaN or infinite values are written as null.
+ * @param   buf is buffer address to store the null-terminated record
+ * @param   len is size of buf (at least JSON_SAMPLE_MAX_LEN)
+ * @param   lat Latitude in degrees
+ * @param   lng Longitude in degrees
+ * @param   alt Altitude in metres
+ * @param   pm25 PM2.5 concentration
  * @param   aqi Air quality index
+ * @return  length of the record; 0 if buf is too small
+ */
+size_t formatJsonData(char* buf, size_t len, double lat, double lng, double alt, uint32_t pm25, float aqi);
+
+/**
+ * @brief   Start an empty JSON array batch in buf
+ * @param   batch is batch to initialize (also used to reset it)
+ * @param   buf is buffer address to build the array in
+ * @param   size is size of buf
+ * @return  none
+ */
+void jsonBatchInit(json_batch_t* batch, char* buf, size_t size);
+
+/**
+ * @brief   Start an empty batch of raw records (no brackets or separators)
+ * @param   batch is batch to initialize (also used to reset it)
+ * @param   buf is buffer address to build the batch in
+ * @param   size is size of buf
+ * @param   delta is true to delta code binary records on jsonBatchFinish()
  * @return  none
  */
-void parseAllDataToJson(ring_buffer_t* rb, float lat, float lng, float alt, uint32_t pm25, float aqi);
+void jsonBatchInitRaw(json_batch_t* batch, char* buf, size_t size, bool delta);
+
+/**
+ * @brief   Append one JSON record to the batch
+ * @param   batch is batch to append to
+ * @param   rec is JSON record
+ * @param   len is length of rec
+ * @return  0 if success; -1 if the record does not fit
+ */
+int jsonBatchAppend(json_batch_t* batch, const char* rec, size_t len);
+
+/**
+ * @brief   Get the free space left in the batch for records
+ * @param   batch is batch to check
+ * @return  number of record bytes that can still be appended
+ */
+size_t jsonBatchRoom(json_batch_t* batch);
+
+/**
+ * @brief   Wait until the ring buffer holds a record (consumer side)
+ * @param   rb is ring buffer address to wait on
+ * @param   wake is what ends the wait early, NULL for nothing
+ * @return  true if a record is available; false if woken first
+ */
+bool jsonWaitRecord(ring_buffer_spsc_t* rb, const json_wake_t* wake);
+
+/**
+ * @brief   Move JSON records from ring buffer into the batch (consumer side).
+ *          Blocks until the batch holds maxCount records, the next record
+ *          does not fit, or the oldest record in the batch is maxAgeMs old.
+ *          A wake ends the wait first and leaves the batch open; call again
+ *          to go on filling it.
+ * @param   batch is batch to fill
+ * @param   rb is ring buffer address to get records from
+ * @param   maxCount is maximum number of records in the batch
+ * @param   maxAgeMs is maximum age of the oldest record in the batch
+ * @param   wake is what ends the wait early, NULL for nothing
+ * @return  true if the batch is due; false if woken first
+ */
+bool jsonBatchCollect(json_batch_t* batch, ring_buffer_spsc_t* rb, int maxCount, int maxAgeMs, const json_wake_t* wake);
+
+/**
+ * @brief   Move spooled JSON records into the batch, without blocking.
+ *          The records stay in the spool until spoolCommit(); a record that
+ *          does not fit is left for the next batch.
+ * @param   batch is batch to fill
+ * @param   spool is spool to read records from
+ * @param   maxCount is maximum number of records in the batch
+ * @return  number of records in the batch
+ */
+int jsonBatchFromSpool(json_batch_t* batch, spool_t* spool, int maxCount);
+
+/**
+ * @brief   Close the JSON array so that buf holds a complete payload
+ * @param   batch is batch to close
+ * @return  length of the payload
+ */
+size_t jsonBatchFinish(json_batch_t* batch);
 
 #endif
\ No newline at end of file
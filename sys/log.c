@@ -0,0 +1,547 @@
+/**
+ * @file    log.c
+ * @brief   Asynchronous log backend: lock-free line queue drained by a writer thread
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "blog.h"
+#include "log.h"
+#include "logrotate.h"
+#include "retry.h"
+
+#define LOG_QUEUE_MASK      (LOG_QUEUE_LEN - 1)
+#define LOG_FLUSH_WAIT_MS   1000
+#define LOG_FULL_RETRY      1000
+
+#if LOG_BINARY_ENABLE
+#define LOG_ACTIVE_PATH     LOG_BINARY_FILE_PATH
+#elif LOG_TO_FILE
+#define LOG_ACTIVE_PATH     LOG_FILE_PATH
+#endif
+
+_Static_assert((LOG_QUEUE_LEN & LOG_QUEUE_MASK) == 0, "LOG_QUEUE_LEN must be a power of two");
+
+/* bounded MPSC queue: a slot is free for position p when seq == p,
+   and holds the line for p when seq == p + 1 */
+typedef struct {
+    atomic_size_t seq;
+    uint16_t len;
+    char text[LOG_LINE_MAX];
+} log_slot_t;
+
+static log_slot_t logQueue[LOG_QUEUE_LEN];
+static atomic_size_t enqPos = 0;
+static size_t deqPos = 0;                   // writer thread only
+static atomic_size_t writtenPos = 0;        // lines fully written, for log_flush()
+
+static atomic_uint droppedLines = 0;
+static atomic_bool writerIdle = false;
+static bool writerRunning = false;
+static int wakeFd = -1;
+#ifdef LOG_ACTIVE_PATH
+static int fileFd = -1;                    // writer thread only, with fileBytes/fileSince
+static off_t fileBytes = 0;
+static time_t fileSince = 0;
+#endif
+static pthread_once_t logOnce = PTHREAD_ONCE_INIT;
+
+/* binary log call sites, collected by the linker; weak so that a program
+   without any binary LOG_* site still links */
+extern const log_site_t* const __start_log_fmts[] __attribute__((weak));
+extern const log_site_t* const __stop_log_fmts[] __attribute__((weak));
+static uint64_t logStartMs = 0;
+
+/* per-thread line buffer and cached timestamp: strftime runs once a second */
+static __thread char lineBuf[LOG_LINE_MAX];
+static __thread time_t cachedSec = -1;
+static __thread char cachedTime[20];
+
+static size_t logFormatTime(char* buf)
+{
+    time_t t = time(NULL);
+
+    if (t != cachedSec) {
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        strftime(cachedTime, sizeof(cachedTime), "%d-%m-%Y %H:%M:%S", &tm_info);
+        cachedSec = t;
+    }
+
+    size_t n = strlen(cachedTime);
+    memcpy(buf, cachedTime, n);
+    return n;
+}
+
+static size_t logFormat(char* buf, const char* tag, const char* fmt, va_list args)
+{
+    size_t n = 0;
+
+    buf[n++] = '[';
+    n += logFormatTime(buf + n);
+    n += snprintf(buf + n, LOG_LINE_MAX - n, "] [%s] ", tag);
+
+    int m = vsnprintf(buf + n, LOG_LINE_MAX - n, fmt, args);
+    if (m > 0)
+        n += ((size_t) m < LOG_LINE_MAX - n) ? (size_t) m : LOG_LINE_MAX - n - 1;
+
+    /* a cut line still ends with a newline */
+    if (n >= LOG_LINE_MAX - 1)
+        n = LOG_LINE_MAX - 2;
+    buf[n++] = '\n';
+    return n;
+}
+
+#if LOG_TO_CONSOLE || defined(LOG_ACTIVE_PATH)
+static void logWriteAll(int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+#endif
+
+#ifdef LOG_ACTIVE_PATH
+/* raw append to the active file, never rotates */
+static void logFileAppend(const void* buf, size_t len)
+{
+    if (fileFd < 0)
+        return;
+
+    logWriteAll(fileFd, buf, len);
+    fileBytes += len;
+}
+#endif
+
+static uint8_t* putU16(uint8_t* p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v)
+{
+    p = putU16(p, v);
+    return putU16(p, v >> 16);
+}
+
+static uint8_t* putVarint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+static uint8_t* putZigzag(uint8_t* p, int64_t v)
+{
+    return putVarint(p, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+/* record header; the args length byte is filled in by the caller */
+static uint8_t* logBinaryHeader(uint8_t* p, uint16_t id)
+{
+    *p++ = BLOG_REC;
+    p = putU16(p, id);
+    p = putU32(p, (uint32_t) (retryNowMs() - logStartMs));
+    return p + 1;
+}
+
+/* pack the arguments of fmt in order; stops early if the record is full */
+static size_t logPackArgs(uint8_t* buf, size_t size, const char* fmt, va_list args)
+{
+    uint8_t* p = buf;
+    uint8_t* end = buf + size - 32;         // room for '*' arguments and one value
+    blog_spec_t spec;
+
+    while ((fmt = blogNextSpec(fmt, &spec)) != NULL && p < end) {
+        for (int i = 0; i < spec.stars; i++)
+            p = putZigzag(p, va_arg(args, int));
+
+        switch (spec.kind) {
+        case BLOG_ARG_INT: {
+            int64_t v;
+            if (spec.longs == 3)
+                v = va_arg(args, ssize_t);
+            else if (spec.longs == 2)
+                v = va_arg(args, long long);
+            else if (spec.longs == 1)
+                v = va_arg(args, long);
+            else
+                v = va_arg(args, int);
+            p = putZigzag(p, v);
+            break;
+        }
+        case BLOG_ARG_UINT: {
+            uint64_t v;
+            if (spec.longs == 3)
+                v = va_arg(args, size_t);
+            else if (spec.longs == 2)
+                v = va_arg(args, unsigned long long);
+            else if (spec.longs == 1)
+                v = va_arg(args, unsigned long);
+            else
+                v = va_arg(args, unsigned int);
+            p = putVarint(p, v);
+            break;
+        }
+        case BLOG_ARG_DOUBLE: {
+            /* stored as a double either way; %Lf passes a long double */
+            double v = (spec.longs == 2) ? (double) va_arg(args, long double) : va_arg(args, double);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case BLOG_ARG_STR: {
+            const char* str = va_arg(args, const char*);
+            size_t n = (str != NULL) ? strlen(str) : 0;
+            if (n > (size_t) (end - p))
+                n = end - p;
+            p = putVarint(p, n);
+            if (n > 0)
+                memcpy(p, str, n);
+            p += n;
+            break;
+        }
+        case BLOG_ARG_PTR:
+            p = putVarint(p, (uintptr_t) va_arg(args, void*));
+            break;
+        default:
+            break;
+        }
+    }
+
+    return p - buf;
+}
+
+#if LOG_BINARY_ENABLE
+/* session header with every call site, so the file decodes on its own */
+static void logBinarySession(void)
+{
+    const log_site_t* const* first = __start_log_fmts;
+    const log_site_t* const* last = __stop_log_fmts;
+    size_t count = (first != NULL && last != NULL) ? (size_t) (last - first) : 0;
+    struct timespec ts;
+    uint8_t buf[LOG_BATCH_BYTES];
+    uint8_t* p = buf;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memcpy(p, BLOG_MAGIC, 4);
+    p += 4;
+    *p++ = BLOG_VERSION;
+    /* records count ms from logStartMs, also in segments opened by a
+       rotation: stamp the wall-clock time of logStartMs, not of now */
+    uint64_t startUs = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 -
+                       (retryNowMs() - logStartMs) * 1000;
+    p = putU32(p, startUs);
+    p = putU32(p, startUs >> 32);
+    p = putU16(p, count);
+
+    for (size_t i = 0; i < count; i++) {
+        const log_site_t* site = first[i];
+        size_t need = 4 + strlen(site->tag) + strlen(site->fmt) + strlen(site->file) + 3;
+
+        if ((size_t) (p - buf) + need > sizeof(buf)) {
+            logFileAppend(buf, p - buf);
+            p = buf;
+        }
+
+        p = putU16(p, i);
+        p = putU16(p, site->line);
+        for (const char* str[] = { site->tag, site->fmt, site->file }, **s = str; s < str + 3; s++) {
+            size_t n = strlen(*s) + 1;
+            memcpy(p, *s, n);
+            p += n;
+        }
+    }
+
+    logFileAppend(buf, p - buf);
+}
+#endif
+
+#ifdef LOG_ACTIVE_PATH
+static void logFileOpen(void)
+{
+    struct stat st;
+
+    fileFd = open(LOG_ACTIVE_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    fileBytes = (fileFd >= 0 && fstat(fileFd, &st) == 0) ? st.st_size : 0;
+    fileSince = time(NULL);
+#if LOG_BINARY_ENABLE
+    /* every segment carries its own site table */
+    logBinarySession();
+#endif
+}
+
+/* rotate by size or age before a write; compression runs elsewhere */
+static void logFileWrite(const char* buf, size_t len)
+{
+    bool full = (size_t) fileBytes + len > LOG_ROTATE_BYTES;
+    bool old = time(NULL) - fileSince >= LOG_ROTATE_SEC;
+
+    if (fileBytes > 0 && (full || old)) {
+        if (logRotate(LOG_ACTIVE_PATH)) {
+            if (fileFd >= 0)
+                close(fileFd);
+            logFileOpen();
+        } else {
+            /* cannot rename: retry after another full segment */
+            fileBytes = 0;
+            fileSince = time(NULL);
+        }
+    }
+
+    logFileAppend(buf, len);
+}
+#endif
+
+static void logEmit(const char* buf, size_t len)
+{
+#if !LOG_BINARY_ENABLE && LOG_TO_CONSOLE
+    logWriteAll(STDOUT_FILENO, buf, len);
+#endif
+#ifdef LOG_ACTIVE_PATH
+    logFileWrite(buf, len);
+#endif
+    (void) buf;
+    (void) len;
+}
+
+
+static bool logEnqueue(const char* line, size_t len)
+{
+    size_t pos = atomic_load_explicit(&enqPos, memory_order_relaxed);
+    log_slot_t* slot;
+
+    for (;;) {
+        slot = &logQueue[pos & LOG_QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqPos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqPos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->text, line, len);
+    slot->len = len;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/* gather queued lines into buf; returns bytes gathered */
+static size_t logDrain(char* buf, size_t size)
+{
+    size_t len = 0;
+
+    while (len + LOG_LINE_MAX <= size) {
+        log_slot_t* slot = &logQueue[deqPos & LOG_QUEUE_MASK];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != deqPos + 1)
+            break;
+
+        memcpy(buf + len, slot->text, slot->len);
+        len += slot->len;
+        atomic_store_explicit(&slot->seq, deqPos + LOG_QUEUE_LEN, memory_order_release);
+        deqPos++;
+    }
+
+    return len;
+}
+
+static void* logWriterTask(void* arg)
+{
+    static char batch[LOG_BATCH_BYTES];
+
+    while (1) {
+        size_t len = logDrain(batch, sizeof(batch));
+        if (len > 0)
+            logEmit(batch, len);
+
+        unsigned dropped = atomic_exchange(&droppedLines, 0);
+        if (dropped > 0) {
+            char line[LOG_LINE_MAX];
+#if LOG_BINARY_ENABLE
+            uint8_t* p = logBinaryHeader((uint8_t*) line, BLOG_ID_DROPPED);
+            p = putVarint(p, dropped);
+            line[BLOG_REC_HDR_LEN - 1] = p - (uint8_t*) line - BLOG_REC_HDR_LEN;
+            logEmit(line, p - (uint8_t*) line);
+#else
+            char* p = line;
+            *p++ = '[';
+            p += logFormatTime(p);
+            p += snprintf(p, sizeof(line) - (p - line), "] [WRN] %u log line(s) dropped\n", dropped);
+            logEmit(line, p - line);
+#endif
+        }
+
+        if (len > 0) {
+            atomic_store_explicit(&writtenPos, deqPos, memory_order_release);
+            continue;
+        }
+
+        /* producers only signal when told the writer is about to sleep */
+        atomic_store(&writerIdle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        log_slot_t* slot = &logQueue[deqPos & LOG_QUEUE_MASK];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == deqPos + 1) {
+            atomic_store(&writerIdle, false);
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = wakeFd, .events = POLLIN };
+        if (poll(&pfd, 1, LOG_FLUSH_MS) > 0) {
+            uint64_t cnt;
+            if (read(wakeFd, &cnt, sizeof(cnt)) < 0) {
+                /* nothing to do, the queue is checked anyway */
+            }
+        }
+        atomic_store(&writerIdle, false);
+    }
+
+    return arg;
+}
+
+static void logInit(void)
+{
+    for (size_t i = 0; i < LOG_QUEUE_LEN; i++)
+        atomic_init(&logQueue[i].seq, i);
+
+    logStartMs = retryNowMs();
+
+#ifdef LOG_ACTIVE_PATH
+    logFileOpen();
+    logRotateInit(LOG_ACTIVE_PATH);
+#endif
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0)
+        return;
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    writerRunning = (pthread_create(&tid, &attr, logWriterTask, NULL) == 0);
+    pthread_attr_destroy(&attr);
+
+    if (writerRunning)
+        atexit(log_flush);
+}
+
+static void logSubmit(const char* tag, const char* buf, size_t len)
+{
+    /* without a writer thread, fall back to writing in the caller */
+    if (!writerRunning) {
+        logEmit(buf, len);
+        return;
+    }
+
+    /* a full queue drops INF/DBG lines; WRN/ERR wait a little for room */
+    int retry = (tag[0] == 'I' || tag[0] == 'D') ? 0 : LOG_FULL_RETRY;
+    while (!logEnqueue(buf, len)) {
+        if (retry-- <= 0) {
+            atomic_fetch_add(&droppedLines, 1);
+            return;
+        }
+        sched_yield();
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&writerIdle, false)) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {
+            /* counter saturated; the writer is already due to wake up */
+        }
+    }
+}
+
+void log_output(const char *tag, const char *fmt, ...)
+{
+    va_list args;
+
+    pthread_once(&logOnce, logInit);
+
+    va_start(args, fmt);
+    size_t len = logFormat(lineBuf, tag, fmt, args);
+    va_end(args);
+
+    logSubmit(tag, lineBuf, len);
+}
+
+void log_binary(const log_site_t* const* site, ...)
+{
+    va_list args;
+
+    pthread_once(&logOnce, logInit);
+
+    uint8_t* rec = (uint8_t*) lineBuf;
+    uint8_t* p = logBinaryHeader(rec, site - __start_log_fmts);
+
+    va_start(args, site);
+    size_t n = logPackArgs(p, LOG_LINE_MAX - BLOG_REC_HDR_LEN, (*site)->fmt, args);
+    va_end(args);
+
+    rec[BLOG_REC_HDR_LEN - 1] = n;
+    logSubmit((*site)->tag, lineBuf, BLOG_REC_HDR_LEN + n);
+}
+
+long log_allow(log_limit_t* limit, unsigned rate_ms, unsigned burst)
+{
+    uint64_t now = retryNowMs();
+    uint64_t due = atomic_load_explicit(&limit->due, memory_order_relaxed);
+    uint64_t next;
+
+    do {
+        next = ((due > now) ? due : now) + rate_ms;
+        if (next - now > (uint64_t) rate_ms * burst) {
+            atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed);
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&limit->due, &due, next,
+                memory_order_relaxed, memory_order_relaxed));
+
+    if (atomic_load_explicit(&limit->suppressed, memory_order_relaxed) == 0)
+        return 0;
+
+    return atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+}
+
+void log_flush(void)
+{
+    if (!writerRunning)
+        return;
+
+    size_t target = atomic_load(&enqPos);
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) {
+        /* counter saturated; the writer is already due to wake up */
+    }
+
+    for (int i = 0; i < LOG_FLUSH_WAIT_MS; i++) {
+        if ((intptr_t) (atomic_load_explicit(&writtenPos, memory_order_acquire) - target) >= 0)
+            return;
+        usleep(1000);
+    }
+}
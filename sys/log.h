@@ -7,40 +7,142 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "device_setup.h"
 
-static inline void log_output(const char *tag, const char *fmt, ...) {
-    va_list args;
-
-    time_t t = time(NULL);
-    struct tm tm_info;
-    localtime_r(&t, &tm_info); 
-    char time_buf[20];
-    strftime(time_buf, sizeof(time_buf), "%d-%m-%Y %H:%M:%S", &tm_info);
-
-#if LOG_TO_CONSOLE
-    va_start(args, fmt);
-    printf("[%s] [%s] ", time_buf, tag);
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
-#endif
-
-#if LOG_TO_FILE
-    FILE *fp = fopen(LOG_FILE_PATH, "a");
-    if (fp) {
-        va_start(args, fmt);
-        fprintf(fp, "[%s] [%s] ", time_buf, tag);
-        vfprintf(fp, fmt, args);
-        fprintf(fp, "\n");
-        fclose(fp);
-        va_end(args);
-    }
-#endif
-}
-
-#define LOG_INF(fmt, ...) log_output("INF", fmt, ##__VA_ARGS__)
-#define LOG_WRN(fmt, ...) log_output("WRN", fmt, ##__VA_ARGS__)
-#define LOG_ERR(fmt, ...) log_output("ERR", fmt, ##__VA_ARGS__)
-
-#endif
\ No newline at end of file
+/* one formatted line, longer messages are cut */
+#define LOG_LINE_MAX        256
+/* lines waiting for the writer thread, power of two; full queue drops lines */
+#define LOG_QUEUE_LEN       256
+/* bytes the writer gathers into one write() */
+#define LOG_BATCH_BYTES     8192
+/* writer wakes at least this often while idle */
+#define LOG_FLUSH_MS        200
+/* each call site may log LOG_RATE_BURST lines at once, then one per LOG_RATE_MS */
+#define LOG_RATE_MS         1000
+#define LOG_RATE_BURST      10
+
+#define LOG_LEVEL_ERR       1
+#define LOG_LEVEL_WRN       2
+#define LOG_LEVEL_INF       3
+#define LOG_LEVEL_DBG       4
+
+/**
+ * @brief   Format a log line and queue it for the writer thread.
+ *          INF/DBG never block (dropped when the queue is full); WRN/ERR
+ *          yield briefly for room. The writer is started on first use.
+ * @param   tag is level tag ("DBG", "INF", "WRN", "ERR")
+ * @param   fmt is printf format
+ * @return  none
+ */
+void log_output(const char *tag, const char *fmt, ...);
+
+/**
+ * @brief   Wait until every queued line has been written (bounded wait).
+ *          Also runs at exit.
+ * @return  none
+ */
+void log_flush(void);
+
+/* call site of a binary log record; the address of its entry in the
+   "log_fmts" section gives the format ID (sys/blog.h) */
+typedef struct {
+    const char* tag;
+    const char* fmt;
+    const char* file;
+    int line;
+} log_site_t;
+
+/**
+ * @brief   Pack the raw arguments of a log call into a binary record and
+ *          queue it for the writer thread. Used by LOG_* with LOG_BINARY_ENABLE.
+ * @param   site is call site entry in the "log_fmts" section
+ * @return  none
+ */
+void log_binary(const log_site_t* const* site, ...);
+
+/* token bucket of one call site */
+typedef struct {
+    _Atomic uint64_t due;       // theoretical arrival time of the next line (ms)
+    atomic_uint suppressed;
+} log_limit_t;
+
+/**
+ * @brief   Take a token from the bucket of a call site (GCRA, lock-free)
+ * @param   limit is call site bucket
+ * @param   rate_ms is refill interval of one token
+ * @param   burst is bucket size
+ * @return  -1 if the line must be suppressed, otherwise the number of lines
+ *          suppressed since the last one that passed
+ */
+long log_allow(log_limit_t* limit, unsigned rate_ms, unsigned burst);
+
+#if LOG_BINARY_ENABLE
+#define LOG_SITE(tag, fmt, ...) do { \
+        static const log_site_t logSite_ = { tag, fmt, __FILE__, __LINE__ }; \
+        static const log_site_t* const logSiteRef_ \
+            __attribute__((section("log_fmts"), used)) = &logSite_; \
+        log_binary(&logSiteRef_, ##__VA_ARGS__); \
+    } while (0)
+#else
+#define LOG_SITE(tag, fmt, ...) log_output(tag, fmt, ##__VA_ARGS__)
+#endif
+
+/* Before including this header, a source file may set:
+ *   LOG_MODULE          tag printed after the level, e.g. "GPS"
+ *   LOG_MODULE_LEVEL    compile-time level of the module (default LOG_LEVEL)
+ *   LOG_MODULE_RATE_MS, LOG_MODULE_BURST   rate limit of each call site */
+#ifdef LOG_MODULE
+#define LOG_PREFIX "[" LOG_MODULE "] "
+#else
+#define LOG_PREFIX ""
+#endif
+#ifndef LOG_MODULE_LEVEL
+#define LOG_MODULE_LEVEL LOG_LEVEL
+#endif
+#ifndef LOG_MODULE_RATE_MS
+#define LOG_MODULE_RATE_MS LOG_RATE_MS
+#endif
+#ifndef LOG_MODULE_BURST
+#define LOG_MODULE_BURST LOG_RATE_BURST
+#endif
+
+#define LOG_LIMITED(tag, fmt, ...) do { \
+        static log_limit_t logLimit_; \
+        long logSuppressed_ = log_allow(&logLimit_, LOG_MODULE_RATE_MS, LOG_MODULE_BURST); \
+        if (logSuppressed_ > 0) \
+            LOG_SITE(tag, LOG_PREFIX "%ld message(s) suppressed", logSuppressed_); \
+        if (logSuppressed_ >= 0) \
+            LOG_SITE(tag, LOG_PREFIX fmt, ##__VA_ARGS__); \
+    } while (0)
+
+/* disabled level: arguments are still type checked, no code is emitted */
+#define LOG_NONE(fmt, ...) do { \
+        if (0) \
+            log_output("", fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_ERR
+#define LOG_ERR(fmt, ...) LOG_LIMITED("ERR", fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERR(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_WRN
+#define LOG_WRN(fmt, ...) LOG_LIMITED("WRN", fmt, ##__VA_ARGS__)
+#else
+#define LOG_WRN(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_INF
+#define LOG_INF(fmt, ...) LOG_LIMITED("INF", fmt, ##__VA_ARGS__)
+#else
+#define LOG_INF(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_DBG
+#define LOG_DBG(fmt, ...) LOG_LIMITED("DBG", fmt, ##__VA_ARGS__)
+#else
+#define LOG_DBG(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+
+#endif
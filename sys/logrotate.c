@@ -0,0 +1,265 @@
+/**
+ * @file    logrotate.c
+ * @brief   Log file rotation source file
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include "device_setup.h"
+#define LOG_MODULE          "STORE"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_STORE
+#include "sys/log.h"
+#include "sys/logrotate.h"
+
+static pthread_mutex_t rotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotCond = PTHREAD_COND_INITIALIZER;
+static bool rotPending = false;
+static bool rotStarted = false;
+static char rotDir[LOGROTATE_PATH_MAX];
+static char rotBase[LOGROTATE_PATH_MAX];
+static unsigned long rotSeq = 0;            // sequence number of the newest segment
+
+/* <base>.<digit>...: a closed segment, compressed or not, or a leftover of one */
+static bool logRotateIsOurs(const char* name)
+{
+    size_t n = strlen(rotBase);
+
+    return strncmp(name, rotBase, n) == 0 && name[n] == '.' &&
+           name[n + 1] >= '0' && name[n + 1] <= '9';
+}
+
+static bool logRotateIsTemp(const char* name)
+{
+    size_t n = strlen(name);
+    return n > 4 && strcmp(name + n - 4, ".tmp") == 0;
+}
+
+static bool logRotateIsSegment(const char* name)
+{
+    return logRotateIsOurs(name) && !logRotateIsTemp(name);
+}
+
+/* the number after "<base>.", the order segments were closed in */
+static unsigned long logRotateSeq(const char* name)
+{
+    return strtoul(name + strlen(rotBase) + 1, NULL, 10);
+}
+
+static bool logRotateIsCompressed(const char* name)
+{
+    size_t n = strlen(name);
+    return n > 3 && strcmp(name + n - 3, ".gz") == 0;
+}
+
+static bool logRotateExists(const char* name)
+{
+    char gz[LOGROTATE_PATH_MAX + 44];
+    struct stat st;
+
+    snprintf(gz, sizeof(gz), "%s.gz", name);
+    return stat(name, &st) == 0 || stat(gz, &st) == 0;
+}
+
+static int logRotateCompare(const void* a, const void* b)
+{
+    unsigned long sa = logRotateSeq(*(char* const*) a);
+    unsigned long sb = logRotateSeq(*(char* const*) b);
+
+    if (sa != sb)
+        return (sa < sb) ? -1 : 1;
+
+    /* the plain segment and its .gz never both survive a scan */
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* gzip src into src.gz, then remove src */
+static int logRotateCompress(const char* src)
+{
+    char dst[LOGROTATE_PATH_MAX * 2 + 16];
+    char tmp[LOGROTATE_PATH_MAX * 2 + 16];
+    char buf[LOGROTATE_CHUNK];
+    int ret = -1;
+    gzFile out = NULL;
+
+    snprintf(dst, sizeof(dst), "%s.gz", src);
+    snprintf(tmp, sizeof(tmp), "%s.gz.tmp", src);
+
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        goto exit;
+
+    out = gzopen(tmp, LOGROTATE_GZIP_LEVEL);
+    if (out == NULL)
+        goto exit;
+
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (gzwrite(out, buf, n) != n)
+            goto exit;
+    }
+    if (n < 0)
+        goto exit;
+
+    int err = gzclose(out);
+    out = NULL;
+    if (err != Z_OK || rename(tmp, dst) < 0)
+        goto exit;
+
+    unlink(src);
+    ret = 0;
+
+exit:
+    if (out != NULL)
+        gzclose(out);
+    if (ret < 0)
+        unlink(tmp);
+    if (in >= 0)
+        close(in);
+    return ret;
+}
+
+/* compress closed segments, then drop the oldest beyond LOG_ROTATE_KEEP */
+static void logRotateScan(void)
+{
+    char path[LOGROTATE_PATH_MAX * 2 + 2];
+    char** names = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+
+    DIR* dir = opendir(rotDir);
+    if (dir == NULL)
+        return;
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!logRotateIsOurs(ent->d_name))
+            continue;
+
+        /* a compression cut short by a crash; the segment itself is still there */
+        if (logRotateIsTemp(ent->d_name)) {
+            unlinkat(dirfd(dir), ent->d_name, 0);
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            char** grown = realloc(names, cap * sizeof(*names));
+            if (grown == NULL)
+                break;
+            names = grown;
+        }
+
+        names[count] = strdup(ent->d_name);
+        if (names[count] != NULL)
+            count++;
+    }
+    closedir(dir);
+
+    /* by sequence number, not by the wall-clock stamp: the clock may be
+       unset at boot or step back, the newest segments still come last */
+    qsort(names, count, sizeof(*names), logRotateCompare);
+
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", rotDir, names[i]);
+
+        if (i + LOG_ROTATE_KEEP < count) {
+            unlink(path);
+        } else if (LOG_ROTATE_COMPRESS && !logRotateIsCompressed(names[i])) {
+            if (logRotateCompress(path) < 0)
+                LOG_WRN("Compress %s failed: %s", path, strerror(errno));
+        }
+
+        free(names[i]);
+    }
+
+    free(names);
+}
+
+static void* logRotateTask(void* arg)
+{
+    /* only use CPU nobody else wants; fall back to the lowest nice value */
+    struct sched_param param = { .sched_priority = 0 };
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    while (1) {
+        logRotateScan();
+
+        pthread_mutex_lock(&rotLock);
+        while (!rotPending)
+            pthread_cond_wait(&rotCond, &rotLock);
+        rotPending = false;
+        pthread_mutex_unlock(&rotLock);
+    }
+
+    return arg;
+}
+
+void logRotateInit(const char* path)
+{
+    char copy[LOGROTATE_PATH_MAX];
+
+    if (rotStarted)
+        return;
+
+    snprintf(copy, sizeof(copy), "%s", path);
+    snprintf(rotDir, sizeof(rotDir), "%s", dirname(copy));
+    snprintf(copy, sizeof(copy), "%s", path);
+    snprintf(rotBase, sizeof(rotBase), "%s", basename(copy));
+
+    /* carry on after the newest segment of an earlier run */
+    DIR* dir = opendir(rotDir);
+    if (dir != NULL) {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (logRotateIsSegment(ent->d_name) && logRotateSeq(ent->d_name) > rotSeq)
+                rotSeq = logRotateSeq(ent->d_name);
+        }
+        closedir(dir);
+    }
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rotStarted = (pthread_create(&tid, &attr, logRotateTask, NULL) == 0);
+    pthread_attr_destroy(&attr);
+}
+
+bool logRotate(const char* path)
+{
+    char stamp[20];
+    char dst[LOGROTATE_PATH_MAX + 40];
+    time_t t = time(NULL);
+    struct tm tm_info;
+
+    localtime_r(&t, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+
+    /* the stamp is for people only, the sequence number orders segments */
+    do {
+        rotSeq++;
+        snprintf(dst, sizeof(dst), "%s.%06lu-%s", path, rotSeq, stamp);
+    } while (logRotateExists(dst));
+
+    if (rename(path, dst) < 0)
+        return false;
+
+    pthread_mutex_lock(&rotLock);
+    rotPending = true;
+    pthread_cond_signal(&rotCond);
+    pthread_mutex_unlock(&rotLock);
+    return true;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file    logrotate.h
+ * @brief   Log file rotation: closed segments are compressed and pruned by a
+ *          low-priority background thread
+ */
+#ifndef _LOGROTATE_H_
+#define _LOGROTATE_H_
+#include <stdbool.h>
+
+#define LOGROTATE_PATH_MAX          128
+/* read/compress chunk of the background thread */
+#define LOGROTATE_CHUNK             16384
+/* gzip level: low CPU cost, most of the gain on text logs */
+#define LOGROTATE_GZIP_LEVEL        "wb3"
+
+/* A closed segment of <path> is renamed to <path>.<seq>-<YYYYmmdd-HHMMSS>,
+   then compressed to <path>.<seq>-<stamp>.gz. seq grows across runs and
+   orders the segments; the local-time stamp does not, the clock may be
+   unset or step. Only the LOG_ROTATE_KEEP newest segments, compressed or
+   not, stay on disk. */
+
+/**
+ * @brief   Start the background thread for a log file: compresses segments
+ *          left over from an earlier run and applies LOG_ROTATE_KEEP.
+ * @param   path is active log file
+ * @return  none
+ */
+void logRotateInit(const char* path);
+
+/**
+ * @brief   Close the current segment: rename the active file to a stamped
+ *          name and hand it to the background thread. The caller reopens
+ *          path afterwards. Never compresses or deletes in the caller.
+ * @param   path is active log file
+ * @return  true if the file was renamed
+ */
+bool logRotate(const char* path);
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file    payload.c
+ * @brief   Compact binary sample payload, an alternative to JSON records
+ */
+#include <math.h>
+#include <string.h>
+#include "payload.h"
+
+static uint8_t* putU16(uint8_t* p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static uint16_t getU16(const uint8_t* p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+uint16_t payloadAqi10(float aqi)
+{
+    float aqi10 = aqi * 10;
+
+    /* NaN fails every comparison: catch it with the negatives */
+    if (!(aqi10 > 0))
+        return 0;
+    if (aqi10 > UINT16_MAX)
+        return UINT16_MAX;
+    return (uint16_t) lrintf(aqi10);
+}
+
+size_t payloadEncode(uint8_t* buf, size_t len, const payload_sample_t* sample)
+{
+    if (len < PAYLOAD_BIN_RECORD_LEN)
+        return 0;
+
+    uint8_t* p = buf;
+    *p++ = PAYLOAD_BIN_VERSION;
+    p = putU32(p, sample->time);
+    p = putU32(p, (uint32_t) (int32_t) lrint(sample->lat * 1e7));
+    p = putU32(p, (uint32_t) (int32_t) lrint(sample->lon * 1e7));
+    p = putU32(p, (uint32_t) (int32_t) lrint(sample->alt * 1000));
+    p = putU16(p, sample->pm25);
+    p = putU16(p, payloadAqi10(sample->aqi));
+
+    return p - buf;
+}
+
+int payloadDecode(const uint8_t* buf, size_t len, payload_sample_t* sample)
+{
+    if (len < 1)
+        return 0;
+
+    if (buf[0] != PAYLOAD_BIN_VERSION)
+        return -1;
+
+    if (len < PAYLOAD_BIN_RECORD_LEN)
+        return 0;
+
+    sample->time = getU32(buf + 1);
+    sample->lat = (int32_t) getU32(buf + 5) / 1e7;
+    sample->lon = (int32_t) getU32(buf + 9) / 1e7;
+    sample->alt = (int32_t) getU32(buf + 13) / 1000.0;
+    sample->pm25 = getU16(buf + 17);
+    sample->aqi = getU16(buf + 19) / 10.0f;
+
+    return PAYLOAD_BIN_RECORD_LEN;
+}
+
+static uint8_t* putVarint(uint8_t* p, int64_t v)
+{
+    uint64_t z = ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+
+    while (z >= 0x80) {
+        *p++ = (uint8_t) z | 0x80;
+        z >>= 7;
+    }
+    *p++ = (uint8_t) z;
+    return p;
+}
+
+static int getVarint(const uint8_t* p, size_t len, int64_t* v)
+{
+    uint64_t z = 0;
+
+    for (size_t i = 0; i < len && i < 10; i++) {
+        z |= (uint64_t) (p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static void deltaFromRecord(payload_delta_t* d, const uint8_t* rec)
+{
+    d->valid = true;
+    d->sinceKey = 0;
+    d->time = getU32(rec + 1);
+    d->lat = (int32_t) getU32(rec + 5);
+    d->lon = (int32_t) getU32(rec + 9);
+    d->alt = (int32_t) getU32(rec + 13);
+    d->pm25 = getU16(rec + 17);
+    d->aqi10 = getU16(rec + 19);
+}
+
+static void deltaToSample(const payload_delta_t* d, payload_sample_t* sample)
+{
+    sample->time = d->time;
+    sample->lat = d->lat / 1e7;
+    sample->lon = d->lon / 1e7;
+    sample->alt = d->alt / 1000.0;
+    sample->pm25 = d->pm25;
+    sample->aqi = d->aqi10 / 10.0f;
+}
+
+size_t payloadDeltaBatch(uint8_t* buf, size_t len)
+{
+    payload_delta_t prev = {0};
+    size_t in = 0, out = 0;
+
+    /* out never passes in, every entry is at most as long as its record */
+    while (in + PAYLOAD_BIN_RECORD_LEN <= len && buf[in] == PAYLOAD_BIN_VERSION) {
+        payload_delta_t cur;
+        deltaFromRecord(&cur, buf + in);
+
+        uint8_t entry[PAYLOAD_BIN_RECORD_LEN + 60];
+        size_t n = PAYLOAD_BIN_RECORD_LEN;
+
+        if (prev.valid && prev.sinceKey + 1 < PAYLOAD_DELTA_KEYFRAME_INTERVAL) {
+            uint8_t* p = entry;
+            *p++ = PAYLOAD_DELTA_TAG;
+            p = putVarint(p, (int64_t) cur.time - prev.time);
+            p = putVarint(p, (int64_t) cur.lat - prev.lat);
+            p = putVarint(p, (int64_t) cur.lon - prev.lon);
+            p = putVarint(p, (int64_t) cur.alt - prev.alt);
+            p = putVarint(p, (int64_t) cur.pm25 - prev.pm25);
+            p = putVarint(p, (int64_t) cur.aqi10 - prev.aqi10);
+            n = p - entry;
+        }
+
+        if (n < PAYLOAD_BIN_RECORD_LEN) {
+            cur.sinceKey = prev.sinceKey + 1;
+            memcpy(buf + out, entry, n);
+        } else {
+            n = PAYLOAD_BIN_RECORD_LEN;
+            memmove(buf + out, buf + in, n);
+        }
+
+        prev = cur;
+        in += PAYLOAD_BIN_RECORD_LEN;
+        out += n;
+    }
+
+    /* anything that is not a v1 record is passed on untouched */
+    memmove(buf + out, buf + in, len - in);
+    return out + (len - in);
+}
+
+void payloadDeltaInit(payload_delta_t* state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+int payloadDecodeNext(payload_delta_t* state, const uint8_t* buf, size_t len, payload_sample_t* sample)
+{
+    if (len < 1)
+        return 0;
+
+    if (buf[0] == PAYLOAD_BIN_VERSION) {
+        if (len < PAYLOAD_BIN_RECORD_LEN)
+            return 0;
+
+        deltaFromRecord(state, buf);
+        deltaToSample(state, sample);
+        return PAYLOAD_BIN_RECORD_LEN;
+    }
+
+    if (buf[0] != PAYLOAD_DELTA_TAG || !state->valid)
+        return -1;
+
+    int64_t d[6];
+    size_t off = 1;
+
+    for (int i = 0; i < 6; i++) {
+        int n = getVarint(buf + off, len - off, &d[i]);
+        if (n == 0)
+            return 0;
+        off += n;
+    }
+
+    state->time += d[0];
+    state->lat += d[1];
+    state->lon += d[2];
+    state->alt += d[3];
+    state->pm25 += d[4];
+    state->aqi10 += d[5];
+    state->sinceKey++;
+
+    deltaToSample(state, sample);
+    return off;
+}
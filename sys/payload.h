@@ -0,0 +1,103 @@
+/**
+ * @file    payload.h
+ * @brief   Compact binary sample payload, an alternative to JSON records
+ */
+#ifndef _PAYLOAD_H_
+#define _PAYLOAD_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* binary record v1, little-endian, no padding:
+ *   0  u8   version (PAYLOAD_BIN_VERSION)
+ *   1  u32  time, unix seconds
+ *   5  i32  latitude, degrees * 1e7
+ *   9  i32  longitude, degrees * 1e7
+ *  13  i32  altitude, millimetres
+ *  17  u16  PM2.5, ug/m3
+ *  19  u16  AQI * 10
+ * A batch is records back to back; the version byte gives each record's length. */
+#define PAYLOAD_BIN_VERSION         1
+#define PAYLOAD_BIN_RECORD_LEN      21
+
+/* delta entry, only valid after a v1 record (the keyframe) in the same batch:
+ *   0  u8   PAYLOAD_DELTA_TAG
+ *   1  zig-zag varints of the change since the previous sample, in v1 units:
+ *      time, latitude, longitude, altitude, PM2.5, AQI * 10
+ * A v1 keyframe is sent every PAYLOAD_DELTA_KEYFRAME_INTERVAL samples, and
+ * whenever a delta entry would not be shorter. */
+#define PAYLOAD_DELTA_TAG               2
+#define PAYLOAD_DELTA_KEYFRAME_INTERVAL 16
+
+typedef struct {
+    uint32_t time;
+    double lat;
+    double lon;
+    double alt;
+    uint16_t pm25;
+    float aqi;
+} payload_sample_t;
+
+/* previous sample in v1 units, shared by delta encoder and decoder */
+typedef struct {
+    bool valid;
+    int sinceKey;
+    uint32_t time;
+    int32_t lat;
+    int32_t lon;
+    int32_t alt;
+    uint16_t pm25;
+    uint16_t aqi10;
+} payload_delta_t;
+
+/**
+ * @brief   Convert an AQI reading to the stored AQI * 10
+ * @param   aqi is AQI reading
+ * @return  rounded AQI * 10, clamped to 0..UINT16_MAX; 0 for NaN
+ */
+uint16_t payloadAqi10(float aqi);
+
+/**
+ * @brief   Encode one sample as a binary record
+ * @param   buf is buffer address to store the record
+ * @param   len is size of buf
+ * @param   sample is sample to encode
+ * @return  length of the record; 0 if it does not fit
+ */
+size_t payloadEncode(uint8_t* buf, size_t len, const payload_sample_t* sample);
+
+/**
+ * @brief   Decode one binary record
+ * @param   buf is address of the record
+ * @param   len is number of bytes available at buf
+ * @param   sample is decoded sample
+ * @return  length of the record; 0 if truncated; -1 if the version is unknown
+ */
+int payloadDecode(const uint8_t* buf, size_t len, payload_sample_t* sample);
+
+/**
+ * @brief   Turn a batch of v1 records into keyframes and delta entries, in place
+ * @param   buf is address of the batch
+ * @param   len is length of the batch
+ * @return  new length of the batch (never longer)
+ */
+size_t payloadDeltaBatch(uint8_t* buf, size_t len);
+
+/**
+ * @brief   Reset delta decoding, e.g. at the start of each payload
+ * @param   state is decoder state
+ * @return  none
+ */
+void payloadDeltaInit(payload_delta_t* state);
+
+/**
+ * @brief   Decode the next v1 record or delta entry of a payload
+ * @param   state is decoder state, carried from entry to entry
+ * @param   buf is address of the entry
+ * @param   len is number of bytes available at buf
+ * @param   sample is decoded sample
+ * @return  length of the entry; 0 if truncated; -1 if unknown or a delta has no keyframe
+ */
+int payloadDecodeNext(payload_delta_t* state, const uint8_t* buf, size_t len, payload_sample_t* sample);
+
+#endif
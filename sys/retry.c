@@ -0,0 +1,164 @@
+/**
+ * @file    retry.c
+ * @brief   Retry scheduling: monotonic timer wheel and exponential backoff with jitter
+ */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "retry.h"
+
+uint64_t retryNowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t timerWheelTickOf(const timer_wheel_t* wheel, uint64_t nowMs)
+{
+    return (nowMs - wheel->startMs) / TIMER_WHEEL_TICK_MS;
+}
+
+static void timerWheelUnlink(timer_wheel_t* wheel, timer_entry_t* timer)
+{
+    timer_entry_t** pp = &wheel->slots[timer->expireTick % TIMER_WHEEL_SLOTS];
+
+    while (*pp != NULL) {
+        if (*pp == timer) {
+            *pp = timer->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+
+    timer->next = NULL;
+    timer->armed = false;
+}
+
+void timerWheelInit(timer_wheel_t* wheel, uint64_t nowMs)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->startMs = nowMs;
+}
+
+void timerWheelArm(timer_wheel_t* wheel, timer_entry_t* timer, uint32_t delayMs, timer_cb_t cb, void* arg)
+{
+    if (timer->armed)
+        timerWheelUnlink(wheel, timer);
+
+    /* never expire in the tick being processed, at least one tick ahead */
+    uint64_t ticks = (delayMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    if (ticks == 0)
+        ticks = 1;
+
+    timer->expireTick = wheel->tick + ticks;
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->armed = true;
+
+    timer_entry_t** slot = &wheel->slots[timer->expireTick % TIMER_WHEEL_SLOTS];
+    timer->next = *slot;
+    *slot = timer;
+}
+
+void timerWheelCancel(timer_wheel_t* wheel, timer_entry_t* timer)
+{
+    if (timer->armed)
+        timerWheelUnlink(wheel, timer);
+}
+
+int timerWheelAdvance(timer_wheel_t* wheel, uint64_t nowMs)
+{
+    uint64_t target = timerWheelTickOf(wheel, nowMs);
+    int fired = 0;
+
+    /* after a long stall one full turn visits every slot */
+    if (target > wheel->tick + TIMER_WHEEL_SLOTS)
+        wheel->tick = target - TIMER_WHEEL_SLOTS;
+
+    while (wheel->tick < target) {
+        wheel->tick++;
+        timer_entry_t** pp = &wheel->slots[wheel->tick % TIMER_WHEEL_SLOTS];
+
+        while (*pp != NULL) {
+            timer_entry_t* timer = *pp;
+            if (timer->expireTick > target) {
+                pp = &timer->next;
+                continue;
+            }
+
+            *pp = timer->next;
+            timer->next = NULL;
+            timer->armed = false;
+            fired++;
+
+            /* the callback may re-arm into this slot, the list head is re-read */
+            timer->cb(timer->arg);
+        }
+    }
+
+    return fired;
+}
+
+int64_t timerWheelNextMs(const timer_wheel_t* wheel, uint64_t nowMs)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        for (timer_entry_t* t = wheel->slots[i]; t != NULL; t = t->next) {
+            if (t->expireTick < next)
+                next = t->expireTick;
+        }
+    }
+
+    if (next == UINT64_MAX)
+        return -1;
+
+    uint64_t expireMs = wheel->startMs + next * TIMER_WHEEL_TICK_MS;
+    return (expireMs > nowMs) ? (int64_t) (expireMs - nowMs) : 0;
+}
+
+/* xorshift32; jitter only needs to de-correlate devices, but devices booted
+   together read the same monotonic clock, so seed from the kernel pool */
+static uint32_t backoffRandom(void)
+{
+    static uint32_t state = 0;
+
+    if (state == 0) {
+        /* the pool may not be ready early in boot: fall back to clock and pid */
+        if (getrandom(&state, sizeof(state), GRND_NONBLOCK) != sizeof(state))
+            state = (uint32_t) retryNowMs() ^ ((uint32_t) getpid() << 16);
+        state |= 1;
+    }
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+uint32_t backoffNext(backoff_t* b)
+{
+    uint32_t shift = (b->attempt < 16) ? b->attempt : 16;
+    uint64_t delay = (uint64_t) b->baseMs << shift;
+
+    if (delay > b->capMs)
+        delay = b->capMs;
+
+    if (b->attempt < UINT32_MAX)
+        b->attempt++;
+
+    uint32_t half = delay / 2;
+    return half + backoffRandom() % (uint32_t) (delay - half + 1);
+}
+
+bool backoffExhausted(const backoff_t* b)
+{
+    return (b->budget != 0 && b->attempt >= b->budget);
+}
+
+void backoffReset(backoff_t* b)
+{
+    b->attempt = 0;
+}
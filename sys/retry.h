@@ -0,0 +1,113 @@
+/**
+ * @file    retry.h
+ * @brief   Retry scheduling: monotonic timer wheel and exponential backoff with jitter
+ */
+#ifndef _RETRY_H_
+#define _RETRY_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_SLOTS       64
+#define TIMER_WHEEL_TICK_MS     100
+
+typedef void (*timer_cb_t)(void* arg);
+
+/* timer owned by the caller, linked into a wheel slot while armed */
+typedef struct timer_entry {
+    struct timer_entry* next;
+    uint64_t expireTick;
+    timer_cb_t cb;
+    void* arg;
+    bool armed;
+} timer_entry_t;
+
+/* hashed timer wheel; timers longer than one turn wait for their tick in the slot.
+   Not thread-safe: arm, cancel and advance from a single thread. */
+typedef struct {
+    timer_entry_t* slots[TIMER_WHEEL_SLOTS];
+    uint64_t startMs;
+    uint64_t tick;
+} timer_wheel_t;
+
+/* exponential backoff with equal jitter: delay in [d/2, d], d = min(cap, base * 2^attempt) */
+typedef struct {
+    uint32_t baseMs;
+    uint32_t capMs;
+    uint32_t budget;        // attempts before the caller should give up, 0 = unlimited
+    uint32_t attempt;
+} backoff_t;
+
+#define BACKOFF_INIT(base, cap, budget)     { (base), (cap), (budget), 0 }
+
+/**
+ * @brief   Get the monotonic time.
+ * @return  Milliseconds since an arbitrary fixed point.
+ */
+uint64_t retryNowMs(void);
+
+/**
+ * @brief   Initialize an empty timer wheel.
+ * @param   wheel Timer wheel.
+ * @param   nowMs Current monotonic time.
+ * @return  none.
+ */
+void timerWheelInit(timer_wheel_t* wheel, uint64_t nowMs);
+
+/**
+ * @brief   Arm a timer, re-arming it if it is already armed.
+ * @param   wheel Timer wheel.
+ * @param   timer Timer entry, must stay valid while armed.
+ * @param   delayMs Delay from now, rounded up to TIMER_WHEEL_TICK_MS.
+ * @param   cb Callback run from timerWheelAdvance().
+ * @param   arg Argument passed to cb.
+ * @return  none.
+ */
+void timerWheelArm(timer_wheel_t* wheel, timer_entry_t* timer, uint32_t delayMs, timer_cb_t cb, void* arg);
+
+/**
+ * @brief   Cancel a timer; no-op if it is not armed.
+ * @param   wheel Timer wheel.
+ * @param   timer Timer entry.
+ * @return  none.
+ */
+void timerWheelCancel(timer_wheel_t* wheel, timer_entry_t* timer);
+
+/**
+ * @brief   Move the wheel to nowMs and run the callbacks of expired timers.
+ *          Callbacks may arm or cancel timers.
+ * @param   wheel Timer wheel.
+ * @param   nowMs Current monotonic time.
+ * @return  Number of timers that fired.
+ */
+int timerWheelAdvance(timer_wheel_t* wheel, uint64_t nowMs);
+
+/**
+ * @brief   Get the time until the next timer expires.
+ * @param   wheel Timer wheel.
+ * @param   nowMs Current monotonic time.
+ * @return  Milliseconds until the next expiry (0 if overdue); -1 if no timer is armed.
+ */
+int64_t timerWheelNextMs(const timer_wheel_t* wheel, uint64_t nowMs);
+
+/**
+ * @brief   Get the delay before the next attempt and count the attempt.
+ * @param   b Backoff state.
+ * @return  Delay in milliseconds.
+ */
+uint32_t backoffNext(backoff_t* b);
+
+/**
+ * @brief   Check whether the attempt budget is used up.
+ * @param   b Backoff state.
+ * @return  true if budget is non-zero and used up; false otherwise.
+ */
+bool backoffExhausted(const backoff_t* b);
+
+/**
+ * @brief   Start over from the base delay with the full budget (after a success).
+ * @param   b Backoff state.
+ * @return  none.
+ */
+void backoffReset(backoff_t* b);
+
+#endif
@@ -2,8 +2,34 @@
  * @file  ringbuffer.c
  * @brief of ring buffer functions.
  */
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "ringbuffer.h"
 
+/* Copy <len> bytes into memory at <index>, wrapping around the end */
+static void ring_buffer_copy_in(char *mem, ring_buffer_size_t mask, ring_buffer_size_t index,
+                                const char *data, ring_buffer_size_t len) {
+  ring_buffer_size_t first = mask + 1 - index;
+  if(first > len) {
+    first = len;
+  }
+  memcpy(mem + index, data, first);
+  memcpy(mem, data + first, len - first);
+}
+
+/* Copy <len> bytes out of memory from <index>, wrapping around the end */
+static void ring_buffer_copy_out(const char *mem, ring_buffer_size_t mask, ring_buffer_size_t index,
+                                 char *data, ring_buffer_size_t len) {
+  ring_buffer_size_t first = mask + 1 - index;
+  if(first > len) {
+    first = len;
+  }
+  memcpy(data, mem + index, first);
+  memcpy(data + first, mem, len - first);
+}
+
 void ring_buffer_init(ring_buffer_t *buffer, char *buf, size_t buf_size) {
   RING_BUFFER_ASSERT(RING_BUFFER_IS_POWER_OF_TWO(buf_size) == 1);
   buffer->buffer = buf;
@@ -26,10 +52,23 @@ void ring_buffer_queue(ring_buffer_t *buffer, char data) {
 }
 
 void ring_buffer_queue_arr(ring_buffer_t *buffer, const char *data, ring_buffer_size_t size) {
-  /* Add bytes; one by one */
-  ring_buffer_size_t i;
-  for(i = 0; i < size; i++) {
-    ring_buffer_queue(buffer, data[i]);
+  ring_buffer_size_t capacity = RING_BUFFER_MASK(buffer);
+
+  /* Only the newest <capacity> bytes can survive */
+  if(size > capacity) {
+    data += size - capacity;
+    size = capacity;
+  }
+
+  ring_buffer_size_t free_items = capacity - ring_buffer_num_items(buffer);
+
+  ring_buffer_copy_in(buffer->buffer, capacity, buffer->head_index, data, size);
+  buffer->head_index = ((buffer->head_index + size) & RING_BUFFER_MASK(buffer));
+
+  /* Is going to overwrite the oldest bytes? */
+  if(size > free_items) {
+    /* Increase tail index past the overwritten bytes */
+    buffer->tail_index = ((buffer->tail_index + (size - free_items)) & RING_BUFFER_MASK(buffer));
   }
 }
 
@@ -50,13 +89,14 @@ ring_buffer_size_t ring_buffer_dequeue_arr(ring_buffer_t *buffer, char *data, ri
     return 0;
   }
 
-  char *data_ptr = data;
-  ring_buffer_size_t cnt = 0;
-  while((cnt < len) && ring_buffer_dequeue(buffer, data_ptr)) {
-    cnt++;
-    data_ptr++;
+  ring_buffer_size_t items = ring_buffer_num_items(buffer);
+  if(len > items) {
+    len = items;
   }
-  return cnt;
+
+  ring_buffer_copy_out(buffer->buffer, RING_BUFFER_MASK(buffer), buffer->tail_index, data, len);
+  buffer->tail_index = ((buffer->tail_index + len) & RING_BUFFER_MASK(buffer));
+  return len;
 }
 
 uint8_t ring_buffer_peek(ring_buffer_t *buffer, char *data, ring_buffer_size_t index) {
@@ -71,6 +111,211 @@ uint8_t ring_buffer_peek(ring_buffer_t *buffer, char *data, ring_buffer_size_t i
   return 1;
 }
 
+int ring_buffer_spsc_init(ring_buffer_spsc_t *buffer, char *buf, size_t buf_size) {
+  RING_BUFFER_ASSERT(RING_BUFFER_IS_POWER_OF_TWO(buf_size) == 1);
+  buffer->buffer = buf;
+  buffer->buffer_mask = buf_size - 1;
+  atomic_init(&buffer->tail_index, 0);
+  atomic_init(&buffer->head_index, 0);
+
+  buffer->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return (buffer->event_fd < 0) ? -1 : 0;
+}
+
+/*
+ * SPSC indexes are free-running counters, masked only to address memory:
+ * head - tail is the fill level, and a tail value is never seen twice, so
+ * a compare-and-swap on it cannot succeed against a stale record.
+ */
+
+ring_buffer_size_t ring_buffer_spsc_queue_arr(ring_buffer_spsc_t *buffer, const char *data, ring_buffer_size_t size) {
+  /* Only the producer writes head; tail may move concurrently but only frees space */
+  ring_buffer_size_t head = atomic_load_explicit(&buffer->head_index, memory_order_relaxed);
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  ring_buffer_size_t free_items = RING_BUFFER_MASK(buffer) - (head - tail);
+
+  if(size == 0 || size > free_items) {
+    /* Never overwrite bytes the consumer may be reading */
+    return 0;
+  }
+
+  ring_buffer_copy_in(buffer->buffer, RING_BUFFER_MASK(buffer), head & RING_BUFFER_MASK(buffer), data, size);
+
+  /* Publish the bytes before the consumer can see the new head */
+  atomic_store_explicit(&buffer->head_index, head + size, memory_order_release);
+
+  uint64_t one = 1;
+  if(write(buffer->event_fd, &one, sizeof(one)) < 0) {
+    /* Counter saturated; the consumer is already due to wake up */
+  }
+  return size;
+}
+
+ring_buffer_size_t ring_buffer_spsc_dequeue_arr(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len) {
+  /* Only the consumer writes tail; head may move concurrently but only adds items */
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_relaxed);
+  ring_buffer_size_t head = atomic_load_explicit(&buffer->head_index, memory_order_acquire);
+  ring_buffer_size_t items = head - tail;
+
+  if(len > items) {
+    len = items;
+  }
+  if(len == 0) {
+    /* No items */
+    return 0;
+  }
+
+  ring_buffer_copy_out(buffer->buffer, RING_BUFFER_MASK(buffer), tail & RING_BUFFER_MASK(buffer), data, len);
+
+  /* Hand the space back to the producer only after the copy is done */
+  atomic_store_explicit(&buffer->tail_index, tail + len, memory_order_release);
+  return len;
+}
+
+ring_buffer_size_t ring_buffer_spsc_num_items(ring_buffer_spsc_t *buffer) {
+  /* Tail first: head only grows, so the difference is never negative */
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  ring_buffer_size_t head = atomic_load_explicit(&buffer->head_index, memory_order_acquire);
+  return head - tail;
+}
+
+uint8_t ring_buffer_spsc_wait(ring_buffer_spsc_t *buffer, int timeout_ms) {
+  struct pollfd pfd = {
+    .fd = buffer->event_fd,
+    .events = POLLIN
+  };
+
+  while(ring_buffer_spsc_num_items(buffer) == 0) {
+    /* The eventfd counter is sticky, so a queue between the check and poll() is not lost */
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret == 0) {
+      /* Timed out */
+      return 0;
+    }
+
+    uint64_t cnt;
+    if(ret > 0 && read(buffer->event_fd, &cnt, sizeof(cnt)) < 0) {
+      /* Already drained by an earlier wake-up */
+    }
+  }
+
+  return 1;
+}
+
+int ring_buffer_push_record(ring_buffer_spsc_t *buffer, const char *data, ring_buffer_size_t len) {
+  ring_buffer_size_t need = RING_BUFFER_RECORD_HEADER + len;
+  if(len == 0 || need > RING_BUFFER_MASK(buffer)) {
+    /* Record can never fit */
+    return -1;
+  }
+
+  ring_buffer_size_t head = atomic_load_explicit(&buffer->head_index, memory_order_relaxed);
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  int dropped = 0;
+
+  /* Drop whole records from the tail until the new one fits */
+  while(RING_BUFFER_MASK(buffer) - (head - tail) < need) {
+    uint32_t rec_len;
+    ring_buffer_copy_out(buffer->buffer, RING_BUFFER_MASK(buffer), tail & RING_BUFFER_MASK(buffer),
+                         (char *)&rec_len, RING_BUFFER_RECORD_HEADER);
+    ring_buffer_size_t next = tail + RING_BUFFER_RECORD_HEADER + rec_len;
+
+    /* Races with pop_record; on failure tail is reloaded and we retry */
+    if(atomic_compare_exchange_weak_explicit(&buffer->tail_index, &tail, next,
+                                             memory_order_acq_rel, memory_order_acquire)) {
+      tail = next;
+      dropped++;
+    }
+  }
+
+  uint32_t hdr = (uint32_t)len;
+  ring_buffer_copy_in(buffer->buffer, RING_BUFFER_MASK(buffer), head & RING_BUFFER_MASK(buffer),
+                      (const char *)&hdr, RING_BUFFER_RECORD_HEADER);
+  ring_buffer_copy_in(buffer->buffer, RING_BUFFER_MASK(buffer),
+                      (head + RING_BUFFER_RECORD_HEADER) & RING_BUFFER_MASK(buffer), data, len);
+
+  /* Publish the whole record before the consumer can see the new head */
+  atomic_store_explicit(&buffer->head_index, head + need, memory_order_release);
+
+  uint64_t one = 1;
+  if(write(buffer->event_fd, &one, sizeof(one)) < 0) {
+    /* Counter saturated; the consumer is already due to wake up */
+  }
+  return dropped;
+}
+
+/*
+ * Copies the record at <*tail> into <data>. Returns 0 if the buffer is empty,
+ * otherwise the full record length, with <*next> set to the following record.
+ * The copy is only valid if tail has not moved in the meantime.
+ */
+static ring_buffer_size_t ring_buffer_read_record(ring_buffer_spsc_t *buffer, ring_buffer_size_t *tail,
+                                                  ring_buffer_size_t *next, char *data, ring_buffer_size_t len) {
+  while(1) {
+    ring_buffer_size_t head = atomic_load_explicit(&buffer->head_index, memory_order_acquire);
+    ring_buffer_size_t items = head - *tail;
+    if(items == 0) {
+      /* No records */
+      return 0;
+    }
+
+    uint32_t rec_len;
+    ring_buffer_copy_out(buffer->buffer, RING_BUFFER_MASK(buffer), *tail & RING_BUFFER_MASK(buffer),
+                         (char *)&rec_len, RING_BUFFER_RECORD_HEADER);
+    if(items <= RING_BUFFER_MASK(buffer) && rec_len > 0 &&
+       RING_BUFFER_RECORD_HEADER + (ring_buffer_size_t)rec_len <= items) {
+      ring_buffer_size_t copy = (rec_len < len) ? rec_len : len;
+      ring_buffer_copy_out(buffer->buffer, RING_BUFFER_MASK(buffer),
+                           (*tail + RING_BUFFER_RECORD_HEADER) & RING_BUFFER_MASK(buffer), data, copy);
+      *next = *tail + RING_BUFFER_RECORD_HEADER + rec_len;
+      return rec_len;
+    }
+
+    /* Header was overwritten by the producer dropping it; start over */
+    *tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  }
+}
+
+ring_buffer_size_t ring_buffer_pop_record(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len) {
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  ring_buffer_size_t next;
+  ring_buffer_size_t rec_len;
+
+  do {
+    rec_len = ring_buffer_read_record(buffer, &tail, &next, data, len);
+    if(rec_len == 0) {
+      return 0;
+    }
+    /* Fails if the producer dropped this record while it was being copied */
+  } while(!atomic_compare_exchange_strong_explicit(&buffer->tail_index, &tail, next,
+                                                   memory_order_acq_rel, memory_order_acquire));
+
+  /* The full length, so that the caller can tell a truncated copy */
+  return rec_len;
+}
+
+ring_buffer_size_t ring_buffer_peek_record(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len) {
+  ring_buffer_size_t tail = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+  ring_buffer_size_t next;
+  ring_buffer_size_t rec_len;
+
+  while(1) {
+    rec_len = ring_buffer_read_record(buffer, &tail, &next, data, len);
+    if(rec_len == 0) {
+      return 0;
+    }
+
+    /* Still the oldest record after the copy? */
+    ring_buffer_size_t check = atomic_load_explicit(&buffer->tail_index, memory_order_acquire);
+    if(check == tail) {
+      break;
+    }
+    tail = check;
+  }
+
+  return rec_len;
+}
+
 extern inline uint8_t ring_buffer_is_empty(ring_buffer_t *buffer);
 extern inline uint8_t ring_buffer_is_full(ring_buffer_t *buffer);
 extern inline ring_buffer_size_t ring_buffer_num_items(ring_buffer_t *buffer);
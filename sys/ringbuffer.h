@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #ifndef RINGBUFFER_H
 #define RINGBUFFER_H
@@ -78,6 +79,8 @@ void ring_buffer_queue(ring_buffer_t *buffer, char data);
 
 /**
  * Adds an array of bytes to a ring buffer.
+ * The bytes are copied in at most two contiguous spans; if there is not
+ * enough room, the oldest bytes are overwritten.
  * @param buffer The buffer in which the data should be placed.
  * @param data A pointer to the array of bytes to place in the queue.
  * @param size The size of the array.
@@ -137,6 +140,126 @@ inline ring_buffer_size_t ring_buffer_num_items(ring_buffer_t *buffer) {
   return ((buffer->head_index - buffer->tail_index) & RING_BUFFER_MASK(buffer));
 }
 
+/**
+ * Size of the length prefix stored in front of every record.
+ */
+#define RING_BUFFER_RECORD_HEADER sizeof(uint32_t)
+
+/**
+ * Simplifies the use of <tt>struct ring_buffer_spsc_t</tt>.
+ */
+typedef struct ring_buffer_spsc_t ring_buffer_spsc_t;
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer.
+ * Exactly one thread may queue and exactly one thread may dequeue.
+ * Head is only written by the producer and tail only by the consumer,
+ * both with release/acquire ordering; an eventfd wakes up the consumer.
+ * Unlike <tt>ring_buffer_t</tt>, a full buffer rejects new data instead
+ * of overwriting the oldest bytes.
+ */
+struct ring_buffer_spsc_t {
+  /** Buffer memory. */
+  char *buffer;
+  /** Buffer mask. */
+  ring_buffer_size_t buffer_mask;
+  /** Free-running index of tail, masked only to address the buffer. */
+  _Atomic ring_buffer_size_t tail_index;
+  /** Free-running index of head, masked only to address the buffer. */
+  _Atomic ring_buffer_size_t head_index;
+  /** Event counter signalled on every queue. */
+  int event_fd;
+};
+
+/**
+ * Initializes the SPSC ring buffer pointed to by <em>buffer</em>.
+ * The resulting buffer can contain <em>buf_size-1</em> bytes.
+ * @param buffer The ring buffer to initialize.
+ * @param buf The buffer allocated for the ringbuffer.
+ * @param buf_size The size of the allocated ringbuffer.
+ * @return 0 on success; -1 if the eventfd could not be created.
+ */
+int ring_buffer_spsc_init(ring_buffer_spsc_t *buffer, char *buf, size_t buf_size);
+
+/**
+ * Adds an array of bytes to an SPSC ring buffer and wakes up the consumer.
+ * Producer side only. The array is queued whole or not at all.
+ * @param buffer The buffer in which the data should be placed.
+ * @param data A pointer to the array of bytes to place in the queue.
+ * @param size The size of the array.
+ * @return <em>size</em> if the data was queued; 0 if there was not enough room.
+ */
+ring_buffer_size_t ring_buffer_spsc_queue_arr(ring_buffer_spsc_t *buffer, const char *data, ring_buffer_size_t size);
+
+/**
+ * Returns the <em>len</em> oldest bytes in an SPSC ring buffer.
+ * Consumer side only.
+ * @param buffer The buffer from which the data should be returned.
+ * @param data A pointer to the array at which the data should be placed.
+ * @param len The maximum number of bytes to return.
+ * @return The number of bytes returned.
+ */
+ring_buffer_size_t ring_buffer_spsc_dequeue_arr(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len);
+
+/**
+ * Returns the number of items in an SPSC ring buffer.
+ * The value is a snapshot and may be stale by the time it is used.
+ * @param buffer The buffer for which the number of items should be returned.
+ * @return The number of items in the ring buffer.
+ */
+ring_buffer_size_t ring_buffer_spsc_num_items(ring_buffer_spsc_t *buffer);
+
+/**
+ * Blocks the consumer until the SPSC ring buffer is not empty.
+ * @param buffer The buffer to wait on.
+ * @param timeout_ms Maximum time to wait per wake-up in milliseconds; -1 waits forever.
+ * @return 1 if data is available; 0 on timeout.
+ */
+uint8_t ring_buffer_spsc_wait(ring_buffer_spsc_t *buffer, int timeout_ms);
+
+/*
+ * Record queue on top of the SPSC ring buffer.
+ * Each record is stored as a <tt>RING_BUFFER_RECORD_HEADER</tt> length prefix
+ * followed by its bytes, so the consumer always gets whole records back.
+ * When the buffer is full the producer drops whole records from the tail;
+ * tail is then moved with compare-and-swap by both sides.
+ * Do not mix record and byte calls on the same buffer.
+ */
+
+/**
+ * Adds a record to an SPSC ring buffer and wakes up the consumer.
+ * Producer side only. The oldest whole records are dropped to make room.
+ * @param buffer The buffer in which the record should be placed.
+ * @param data A pointer to the record bytes.
+ * @param len The length of the record, at most <em>buf_size-1-RING_BUFFER_RECORD_HEADER</em>.
+ * @return The number of old records dropped; -1 if the record can never fit.
+ */
+int ring_buffer_push_record(ring_buffer_spsc_t *buffer, const char *data, ring_buffer_size_t len);
+
+/**
+ * Removes the oldest record from an SPSC ring buffer.
+ * Consumer side only. Only the first <em>len</em> bytes of a longer record
+ * are copied; the record is removed all the same.
+ * @param buffer The buffer from which the record should be returned.
+ * @param data A pointer to the array at which the record should be placed.
+ * @param len The size of the array.
+ * @return The full record length, more than <em>len</em> if the copy was
+ *         truncated; 0 if there are no records.
+ */
+ring_buffer_size_t ring_buffer_pop_record(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len);
+
+/**
+ * Copies the oldest record from an SPSC ring buffer without removing it.
+ * Consumer side only. Only the first <em>len</em> bytes of a longer record
+ * are copied.
+ * @param buffer The buffer from which the record should be returned.
+ * @param data A pointer to the array at which the record should be placed.
+ * @param len The size of the array.
+ * @return The full record length, more than <em>len</em> if the copy was
+ *         truncated; 0 if there are no records.
+ */
+ring_buffer_size_t ring_buffer_peek_record(ring_buffer_spsc_t *buffer, char *data, ring_buffer_size_t len);
+
 #ifdef __cplusplus
 }
 #endif
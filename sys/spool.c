@@ -0,0 +1,520 @@
+/**
+ * @file    spool.c
+ * @brief   Disk-backed store-and-forward spool: segmented append-only record log
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#define LOG_MODULE          "STORE"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_STORE
+#include "sys/log.h"
+#include "sys/retry.h"
+#include "spool.h"
+
+/* CRC-32 (IEEE), bitwise: records are small and written at sensor rate */
+static uint32_t spoolCrc32(const char* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint8_t) data[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+static void spoolSegPath(spool_t* s, uint32_t seg, char* path, size_t len)
+{
+    snprintf(path, len, "%s/%08u.seg", s->dir, seg);
+}
+
+static void spoolCursorPath(spool_t* s, char* path, size_t len)
+{
+    snprintf(path, len, "%s/cursor", s->dir);
+}
+
+static off_t spoolSegSize(spool_t* s, uint32_t seg)
+{
+    char path[SPOOL_PATH_MAX + 16];
+    struct stat st;
+
+    if (seg == s->tailSeg)
+        return s->tailSize;
+
+    spoolSegPath(s, seg, path, sizeof(path));
+    return (stat(path, &st) == 0) ? st.st_size : 0;
+}
+
+static void spoolCloseRead(spool_t* s)
+{
+    if (s->readFd >= 0)
+        close(s->readFd);
+    s->readFd = -1;
+}
+
+static void spoolSyncLocked(spool_t* s)
+{
+    if (s->writeFd >= 0 && s->unsynced > 0)
+        fdatasync(s->writeFd);
+
+    s->unsynced = 0;
+    s->lastSyncMs = retryNowMs();
+}
+
+static void spoolUnlinkSeg(spool_t* s, uint32_t seg)
+{
+    char path[SPOOL_PATH_MAX + 16];
+
+    spoolSegPath(s, seg, path, sizeof(path));
+    unlink(path);
+}
+
+/* drop the oldest segment to bound disk usage; its records are lost */
+static void spoolDropHead(spool_t* s)
+{
+    LOG_WRN("Spool full - drop segment %u", s->headSeg);
+
+    if (s->readSeg == s->headSeg)
+        spoolCloseRead(s);
+
+    spoolUnlinkSeg(s, s->headSeg);
+    s->headSeg++;
+    s->commitOff = 0;
+
+    if (s->readSeg < s->headSeg) {
+        s->readSeg = s->headSeg;
+        s->readOff = 0;
+    }
+}
+
+static int spoolOpenTail(spool_t* s)
+{
+    char path[SPOOL_PATH_MAX + 16];
+
+    spoolSegPath(s, s->tailSeg, path, sizeof(path));
+    s->writeFd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (s->writeFd < 0) {
+        LOG_ERR("Open %s failed: %s", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* cut the newest segment after its last complete record (power loss mid-write) */
+static void spoolRecoverTail(spool_t* s)
+{
+    char path[SPOOL_PATH_MAX + 16];
+    char rec[SPOOL_RECORD_MAX_LEN];
+    spool_rec_hdr_t hdr;
+    off_t off = 0;
+
+    spoolSegPath(s, s->tailSeg, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    while (pread(fd, &hdr, sizeof(hdr), off) == sizeof(hdr)) {
+        if (hdr.len > SPOOL_RECORD_MAX_LEN ||
+            pread(fd, rec, hdr.len, off + sizeof(hdr)) != (ssize_t) hdr.len ||
+            spoolCrc32(rec, hdr.len) != hdr.crc)
+            break;
+        off += sizeof(hdr) + hdr.len;
+    }
+
+    if (off < s->tailSize) {
+        LOG_WRN("Spool segment %u: cut torn tail at %ld of %ld bytes", s->tailSeg, (long) off, (long) s->tailSize);
+        ftruncate(fd, off);
+        s->tailSize = off;
+    }
+
+    close(fd);
+}
+
+int spoolOpen(spool_t* s, const char* dir)
+{
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->lock, NULL);
+    s->writeFd = -1;
+    s->readFd = -1;
+
+    if (strlen(dir) >= sizeof(s->dir))
+        return -1;
+    strcpy(s->dir, dir);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        LOG_ERR("Create spool dir %s failed: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        LOG_ERR("Open spool dir %s failed: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    bool found = false;
+    uint32_t minSeg = 0, maxSeg = 0;
+    struct dirent* ent;
+
+    while ((ent = readdir(d)) != NULL) {
+        unsigned seg;
+        char ext[8];
+        if (sscanf(ent->d_name, "%8u.%7s", &seg, ext) != 2 || strcmp(ext, "seg") != 0)
+            continue;
+
+        if (!found || seg < minSeg)
+            minSeg = seg;
+        if (!found || seg > maxSeg)
+            maxSeg = seg;
+        found = true;
+    }
+    closedir(d);
+
+    s->headSeg = minSeg;
+    s->tailSeg = maxSeg;
+
+    if (found) {
+        char path[SPOOL_PATH_MAX + 16];
+        struct stat st;
+
+        spoolSegPath(s, s->tailSeg, path, sizeof(path));
+        s->tailSize = (stat(path, &st) == 0) ? st.st_size : 0;
+        spoolRecoverTail(s);
+
+        /* resume after the records delivered before the restart */
+        spoolCursorPath(s, path, sizeof(path));
+        FILE* fp = fopen(path, "r");
+        if (fp != NULL) {
+            unsigned seg;
+            long off;
+            if (fscanf(fp, "%u %ld", &seg, &off) == 2 && seg == s->headSeg && off <= spoolSegSize(s, seg))
+                s->commitOff = off;
+            fclose(fp);
+        }
+    }
+
+    s->readSeg = s->headSeg;
+    s->readOff = s->commitOff;
+    s->lastSyncMs = retryNowMs();
+    s->enabled = true;
+
+    if (found)
+        LOG_INF("Spool %s: segments %u..%u, resume at %ld", dir, s->headSeg, s->tailSeg, (long) s->commitOff);
+
+    return 0;
+}
+
+static bool spoolBacklogLocked(spool_t* s)
+{
+    return (s->headSeg != s->tailSeg || s->commitOff < s->tailSize);
+}
+
+static int spoolAppendLocked(spool_t* s, const char* data, size_t len)
+{
+    spool_rec_hdr_t hdr = {
+        .len = len,
+        .crc = spoolCrc32(data, len)
+    };
+
+    if (s->writeFd >= 0 && s->tailSize + sizeof(hdr) + len > SPOOL_SEGMENT_MAX_BYTES) {
+        spoolSyncLocked(s);
+        close(s->writeFd);
+        s->writeFd = -1;
+        s->tailSeg++;
+        s->tailSize = 0;
+    }
+
+    while (s->tailSeg - s->headSeg >= SPOOL_MAX_SEGMENTS)
+        spoolDropHead(s);
+
+    if (s->writeFd < 0 && spoolOpenTail(s) < 0)
+        return -1;
+
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void*) data, .iov_len = len }
+    };
+
+    ssize_t ret = writev(s->writeFd, iov, 2);
+    if (ret != (ssize_t) (sizeof(hdr) + len)) {
+        LOG_ERR("Spool write failed: %s", (ret < 0) ? strerror(errno) : "short write");
+        /* drop a partial record so the segment stays readable */
+        if (ret > 0)
+            ftruncate(s->writeFd, s->tailSize);
+        return -1;
+    }
+
+    s->tailSize += ret;
+    s->unsynced++;
+
+    if (s->unsynced >= SPOOL_SYNC_RECORDS || retryNowMs() - s->lastSyncMs >= SPOOL_SYNC_MS)
+        spoolSyncLocked(s);
+
+    return 0;
+}
+
+int spoolAppend(spool_t* s, const char* data, size_t len)
+{
+    if (!s->enabled || len == 0 || len > SPOOL_RECORD_MAX_LEN)
+        return -1;
+
+    pthread_mutex_lock(&s->lock);
+    int ret = spoolAppendLocked(s, data, len);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int spoolDivert(spool_t* s, bool down, const char* data, size_t len)
+{
+    if (!s->enabled)
+        return 0;
+
+    if (len == 0 || len > SPOOL_RECORD_MAX_LEN)
+        return -1;
+
+    int ret = 0;
+
+    /* decided under the lock, so a drain that just emptied the spool
+       cannot miss a record appended behind it */
+    pthread_mutex_lock(&s->lock);
+    if (down || spoolBacklogLocked(s))
+        ret = (spoolAppendLocked(s, data, len) == 0) ? 1 : -1;
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+bool spoolBacklog(spool_t* s)
+{
+    if (!s->enabled)
+        return false;
+
+    pthread_mutex_lock(&s->lock);
+    bool ret = spoolBacklogLocked(s);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+bool spoolReadable(spool_t* s)
+{
+    if (!s->enabled)
+        return false;
+
+    pthread_mutex_lock(&s->lock);
+    bool ret = (s->readSeg != s->tailSeg || s->readOff < s->tailSize);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+ssize_t spoolRead(spool_t* s, char* buf, size_t len)
+{
+    if (!s->enabled)
+        return 0;
+
+    ssize_t ret = 0;
+    pthread_mutex_lock(&s->lock);
+
+    while (s->readSeg <= s->tailSeg) {
+        off_t size = spoolSegSize(s, s->readSeg);
+        spool_rec_hdr_t hdr;
+
+        if (s->readOff + (off_t) sizeof(hdr) > size) {
+            if (s->readSeg == s->tailSeg)
+                break;
+            goto next_segment;
+        }
+
+        if (s->readFd < 0) {
+            char path[SPOOL_PATH_MAX + 16];
+            spoolSegPath(s, s->readSeg, path, sizeof(path));
+            s->readFd = open(path, O_RDONLY | O_CLOEXEC);
+            if (s->readFd < 0) {
+                LOG_WRN("Spool segment %u missing - skip", s->readSeg);
+                goto next_segment;
+            }
+        }
+
+        if (pread(s->readFd, &hdr, sizeof(hdr), s->readOff) != sizeof(hdr) ||
+            hdr.len > SPOOL_RECORD_MAX_LEN ||
+            s->readOff + (off_t) (sizeof(hdr) + hdr.len) > size) {
+            LOG_WRN("Spool segment %u corrupt at %ld - skip rest", s->readSeg, (long) s->readOff);
+            goto next_segment;
+        }
+
+        if (hdr.len > len) {
+            LOG_WRN("Spool record of %u bytes does not fit - skip", hdr.len);
+            s->readOff += sizeof(hdr) + hdr.len;
+            continue;
+        }
+
+        if (pread(s->readFd, buf, hdr.len, s->readOff + sizeof(hdr)) != (ssize_t) hdr.len ||
+            spoolCrc32(buf, hdr.len) != hdr.crc) {
+            LOG_WRN("Spool segment %u bad record at %ld - skip rest", s->readSeg, (long) s->readOff);
+            goto next_segment;
+        }
+
+        s->lastSeg = s->readSeg;
+        s->lastOff = s->readOff;
+        s->readOff += sizeof(hdr) + hdr.len;
+        ret = hdr.len;
+        break;
+
+next_segment:
+        /* the tail is still being written: skip to its end, new records follow */
+        if (s->readSeg == s->tailSeg) {
+            s->readOff = size;
+            continue;
+        }
+        spoolCloseRead(s);
+        s->readSeg++;
+        s->readOff = 0;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+void spoolUnread(spool_t* s)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->readSeg != s->lastSeg)
+        spoolCloseRead(s);
+    s->readSeg = s->lastSeg;
+    s->readOff = s->lastOff;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* before a, in spool order */
+static bool spoolPosBefore(uint32_t aSeg, off_t aOff, uint32_t bSeg, off_t bOff)
+{
+    return aSeg < bSeg || (aSeg == bSeg && aOff < bOff);
+}
+
+spool_pos_t spoolTell(spool_t* s)
+{
+    if (!s->enabled)
+        return (spool_pos_t) { 0, 0 };
+
+    pthread_mutex_lock(&s->lock);
+    spool_pos_t pos = { s->readSeg, s->readOff };
+    pthread_mutex_unlock(&s->lock);
+    return pos;
+}
+
+void spoolSeek(spool_t* s, spool_pos_t pos)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    /* the segment may have been delivered or dropped meanwhile */
+    if (spoolPosBefore(pos.seg, pos.off, s->headSeg, s->commitOff)) {
+        pos.seg = s->headSeg;
+        pos.off = s->commitOff;
+    }
+    if (s->readSeg != pos.seg)
+        spoolCloseRead(s);
+    s->readSeg = pos.seg;
+    s->readOff = pos.off;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* commit up to seg/off, which lies between the commit point and the read cursor */
+static void spoolCommitLocked(spool_t* s, uint32_t seg, off_t off)
+{
+    char path[SPOOL_PATH_MAX + 16];
+
+    while (s->headSeg < seg) {
+        spoolUnlinkSeg(s, s->headSeg);
+        s->headSeg++;
+    }
+    s->commitOff = off;
+
+    spoolCursorPath(s, path, sizeof(path));
+
+    if (s->headSeg == s->tailSeg && s->commitOff >= s->tailSize && s->tailSize > 0) {
+        /* all delivered: start a fresh segment, nothing to resume */
+        spoolCloseRead(s);
+        if (s->writeFd >= 0)
+            close(s->writeFd);
+        s->writeFd = -1;
+        s->unsynced = 0;
+        spoolUnlinkSeg(s, s->tailSeg);
+        unlink(path);
+
+        s->tailSeg++;
+        s->headSeg = s->readSeg = s->tailSeg;
+        s->tailSize = s->commitOff = s->readOff = 0;
+    }
+    else {
+        FILE* fp = fopen(path, "w");
+        if (fp != NULL) {
+            fprintf(fp, "%u %ld\n", s->headSeg, (long) s->commitOff);
+            fclose(fp);
+        }
+    }
+}
+
+void spoolCommit(spool_t* s)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->readSeg != s->headSeg || s->readOff != s->commitOff)
+        spoolCommitLocked(s, s->readSeg, s->readOff);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void spoolCommitTo(spool_t* s, spool_pos_t pos)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    /* nothing if pos is already committed, or was dropped with a full spool */
+    if (spoolPosBefore(s->headSeg, s->commitOff, pos.seg, pos.off)) {
+        if (spoolPosBefore(s->readSeg, s->readOff, pos.seg, pos.off)) {
+            pos.seg = s->readSeg;
+            pos.off = s->readOff;
+        }
+        spoolCommitLocked(s, pos.seg, pos.off);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+void spoolRewind(spool_t* s)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->readSeg != s->headSeg)
+        spoolCloseRead(s);
+    s->readSeg = s->headSeg;
+    s->readOff = s->commitOff;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void spoolSync(spool_t* s)
+{
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    spoolSyncLocked(s);
+    pthread_mutex_unlock(&s->lock);
+}
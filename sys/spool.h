@@ -0,0 +1,161 @@
+/**
+ * @file    spool.h
+ * @brief   Disk-backed store-and-forward spool: segmented append-only record log
+ */
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define SPOOL_PATH_MAX              128
+#define SPOOL_RECORD_MAX_LEN        1024
+#define SPOOL_SEGMENT_MAX_BYTES     (1024 * 1024)
+#define SPOOL_MAX_SEGMENTS          32          // oldest segment is dropped beyond this
+
+/* fsync batching: sync after this many records or this much time, whichever first */
+#define SPOOL_SYNC_RECORDS          16
+#define SPOOL_SYNC_MS               5000
+
+/* on-disk record header, followed by len payload bytes */
+typedef struct {
+    uint32_t len;
+    uint32_t crc;
+} spool_rec_hdr_t;
+
+/* a place in the spool between two records, from spoolTell() */
+typedef struct {
+    uint32_t seg;
+    off_t off;
+} spool_pos_t;
+
+/* segments are <dir>/<seq>.seg; [headSeg, tailSeg] exist on disk.
+   The read cursor moves with spoolRead(), the commit point with spoolCommit(). */
+typedef struct {
+    pthread_mutex_t lock;
+    bool enabled;
+    char dir[SPOOL_PATH_MAX];
+    int writeFd;
+    uint32_t headSeg;
+    uint32_t tailSeg;
+    off_t tailSize;
+    off_t commitOff;            // committed offset inside headSeg
+    uint32_t readSeg;
+    off_t readOff;
+    int readFd;                 // open segment readSeg, -1 if none
+    uint32_t lastSeg;           // start of the record last returned by spoolRead()
+    off_t lastOff;
+    uint32_t unsynced;
+    uint64_t lastSyncMs;
+} spool_t;
+
+/**
+ * @brief   Open (or create) a spool directory and recover existing segments.
+ *          A torn record at the end of the newest segment is cut off.
+ * @param   s Spool.
+ * @param   dir Spool directory, created if missing (parent must exist).
+ * @return  0 on success; -1 on error (the spool stays disabled, calls are no-ops).
+ */
+int spoolOpen(spool_t* s, const char* dir);
+
+/**
+ * @brief   Append a record if the transport is down or a backlog exists,
+ *          so that new records queue behind older spooled ones.
+ * @param   s Spool.
+ * @param   down true if the transport cannot take the record now.
+ * @param   data Record data.
+ * @param   len Record length (<= SPOOL_RECORD_MAX_LEN).
+ * @return  1 if spooled; 0 if the caller should send it directly; -1 on error.
+ */
+int spoolDivert(spool_t* s, bool down, const char* data, size_t len);
+
+/**
+ * @brief   Append a record.
+ * @param   s Spool.
+ * @param   data Record data.
+ * @param   len Record length (<= SPOOL_RECORD_MAX_LEN).
+ * @return  0 on success; -1 on error.
+ */
+int spoolAppend(spool_t* s, const char* data, size_t len);
+
+/**
+ * @brief   Check whether records are waiting to be delivered.
+ * @param   s Spool.
+ * @return  true if there is an uncommitted record; false otherwise.
+ */
+bool spoolBacklog(spool_t* s);
+
+/**
+ * @brief   Check whether records are left after the read cursor.
+ * @param   s Spool.
+ * @return  true if spoolRead() has a record to return; false otherwise.
+ */
+bool spoolReadable(spool_t* s);
+
+/**
+ * @brief   Read the next record after the read cursor.
+ *          Corrupt records are skipped with a warning.
+ * @param   s Spool.
+ * @param   buf Output buffer.
+ * @param   len Output buffer size.
+ * @return  Record length; 0 if no record is left.
+ */
+ssize_t spoolRead(spool_t* s, char* buf, size_t len);
+
+/**
+ * @brief   Put back the record just returned by spoolRead(), it is read again next.
+ *          Only valid right after a spoolRead() that returned a record.
+ * @param   s Spool.
+ * @return  none.
+ */
+void spoolUnread(spool_t* s);
+
+/**
+ * @brief   Mark every record read so far as delivered; fully read segments are deleted.
+ * @param   s Spool.
+ * @return  none.
+ */
+void spoolCommit(spool_t* s);
+
+/**
+ * @brief   Get the read cursor, to commit or seek back to later.
+ * @param   s Spool.
+ * @return  Position after the last record read.
+ */
+spool_pos_t spoolTell(spool_t* s);
+
+/**
+ * @brief   Move the read cursor back to a position from spoolTell(), or to
+ *          the last commit if that is later.
+ * @param   s Spool.
+ * @param   pos Position.
+ * @return  none.
+ */
+void spoolSeek(spool_t* s, spool_pos_t pos);
+
+/**
+ * @brief   Mark the records before pos as delivered, while later ones read
+ *          so far stay uncommitted. No-op if pos is already committed.
+ * @param   s Spool.
+ * @param   pos Position from spoolTell().
+ * @return  none.
+ */
+void spoolCommitTo(spool_t* s, spool_pos_t pos);
+
+/**
+ * @brief   Move the read cursor back to the last commit (delivery failed).
+ * @param   s Spool.
+ * @return  none.
+ */
+void spoolRewind(spool_t* s);
+
+/**
+ * @brief   fsync the newest segment if it has unsynced records.
+ * @param   s Spool.
+ * @return  none.
+ */
+void spoolSync(spool_t* s);
+
+#endif
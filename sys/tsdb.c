@@ -0,0 +1,285 @@
+/**
+ * @file    tsdb.c
+ * @brief   Append-only binary time-series store of flight samples (mmap based)
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define LOG_MODULE          "STORE"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_STORE
+#include "sys/log.h"
+#include "sys/retry.h"
+#include "tsdb.h"
+
+#define TSDB_REC_OFF(i)     (sizeof(tsdb_header_t) + (size_t) (i) * sizeof(tsdb_record_t))
+
+static bool tsdbHeaderValid(const tsdb_header_t* hdr)
+{
+    return (memcmp(hdr->magic, TSDB_MAGIC, 4) == 0 &&
+            hdr->version == TSDB_VERSION &&
+            hdr->recordSize == sizeof(tsdb_record_t));
+}
+
+/* records written after the last header update end at the first zero timestamp */
+static uint64_t tsdbScanCount(const uint8_t* map, size_t mapSize, uint64_t from)
+{
+    uint64_t cap = (mapSize - sizeof(tsdb_header_t)) / sizeof(tsdb_record_t);
+    const tsdb_record_t* rec = (const tsdb_record_t*) (map + sizeof(tsdb_header_t));
+
+    if (from > cap)
+        from = cap;
+
+    while (from < cap && rec[from].timeUs != 0)
+        from++;
+
+    return from;
+}
+
+/* true if any record in [from, to) is older than the one before it */
+static bool tsdbUnordered(const tsdb_record_t* rec, uint64_t from, uint64_t to)
+{
+    for (uint64_t i = (from > 0) ? from : 1; i < to; i++) {
+        if (rec[i].timeUs < rec[i - 1].timeUs)
+            return true;
+    }
+
+    return false;
+}
+
+/* blocks are allocated up front: a store written through a mapping over a
+   hole gets SIGBUS, not an error, when the disk fills up */
+static int tsdbMap(tsdb_t* db, size_t size)
+{
+    int err = posix_fallocate(db->fd, 0, size);
+    if (err != 0) {
+        /* the old mapping stays usable for the records it holds */
+        LOG_ERR("tsdb reserve of %zu bytes failed: %s", size, strerror(err));
+        return -1;
+    }
+
+    if (db->map != NULL)
+        munmap(db->map, db->mapSize);
+    db->map = NULL;
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERR("tsdb mmap failed: %s", strerror(errno));
+        return -1;
+    }
+
+    db->map = map;
+    db->mapSize = size;
+    return 0;
+}
+
+int tsdbOpen(tsdb_t* db, const char* path)
+{
+    struct stat st;
+
+    memset(db, 0, sizeof(*db));
+    db->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (db->fd < 0) {
+        LOG_ERR("Open %s failed: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(db->fd, &st) < 0)
+        goto fail;
+
+    bool fresh = (st.st_size < (off_t) sizeof(tsdb_header_t));
+    size_t size = fresh ? TSDB_REC_OFF(TSDB_GROW_RECORDS) : (size_t) st.st_size;
+
+    if (tsdbMap(db, size) < 0)
+        goto fail;
+
+    tsdb_header_t* hdr = (tsdb_header_t*) db->map;
+
+    if (fresh) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        memset(hdr, 0, sizeof(*hdr));
+        memcpy(hdr->magic, TSDB_MAGIC, 4);
+        hdr->version = TSDB_VERSION;
+        hdr->recordSize = sizeof(tsdb_record_t);
+        hdr->createdUs = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        msync(db->map, sizeof(*hdr), MS_SYNC);
+    } else if (!tsdbHeaderValid(hdr)) {
+        LOG_ERR("%s is not a tsdb v%d file", path, TSDB_VERSION);
+        goto fail;
+    }
+
+    db->count = tsdbScanCount(db->map, db->mapSize, hdr->count);
+    if (db->count > hdr->count)
+        LOG_WRN("tsdb %s: recovered %llu unsynced record(s)", path, (unsigned long long) (db->count - hdr->count));
+
+    const tsdb_record_t* rec = (const tsdb_record_t*) (db->map + sizeof(tsdb_header_t));
+    db->flags = hdr->flags;
+    if (tsdbUnordered(rec, hdr->count, db->count))
+        db->flags |= TSDB_HDR_UNORDERED;
+    db->lastTimeUs = (db->count > 0) ? rec[db->count - 1].timeUs : 0;
+
+    db->syncedCount = hdr->count;
+    db->lastSyncMs = retryNowMs();
+    LOG_INF("tsdb %s: %llu record(s)", path, (unsigned long long) db->count);
+    return 0;
+
+fail:
+    if (db->map != NULL)
+        munmap(db->map, db->mapSize);
+    close(db->fd);
+    db->map = NULL;
+    db->fd = -1;
+    return -1;
+}
+
+int tsdbSync(tsdb_t* db)
+{
+    if (db->map == NULL)
+        return -1;
+
+    db->lastSyncMs = retryNowMs();
+    if (db->count == db->syncedCount)
+        return 0;
+
+    tsdb_header_t* hdr = (tsdb_header_t*) db->map;
+
+    /* records first, then the count that covers them */
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = TSDB_REC_OFF(db->syncedCount) & ~((size_t) page - 1);
+    size_t end = TSDB_REC_OFF(db->count);
+
+    if (msync(db->map + start, end - start, MS_SYNC) < 0) {
+        LOG_ERR("tsdb msync failed: %s", strerror(errno));
+        return -1;
+    }
+
+    hdr->count = db->count;
+    hdr->flags = db->flags;
+    msync(db->map, sizeof(*hdr), MS_SYNC);
+
+    db->syncedCount = db->count;
+    return 0;
+}
+
+int tsdbAppend(tsdb_t* db, const tsdb_record_t* rec)
+{
+    if (db->map == NULL || rec->timeUs == 0)
+        return -1;
+
+    if (TSDB_REC_OFF(db->count + 1) > db->mapSize) {
+        /* the whole file is re-mapped, so sync what the old mapping holds */
+        if (tsdbSync(db) < 0 || tsdbMap(db, db->mapSize + TSDB_GROW_RECORDS * sizeof(tsdb_record_t)) < 0)
+            return -1;
+    }
+
+    if (rec->timeUs < db->lastTimeUs && !(db->flags & TSDB_HDR_UNORDERED)) {
+        LOG_WRN("tsdb: clock stepped back %lld us - store is no longer in time order",
+                (long long) (db->lastTimeUs - rec->timeUs));
+        db->flags |= TSDB_HDR_UNORDERED;
+    }
+
+    memcpy(db->map + TSDB_REC_OFF(db->count), rec, sizeof(*rec));
+    db->count++;
+    db->lastTimeUs = rec->timeUs;
+
+    if (db->count - db->syncedCount >= TSDB_SYNC_RECORDS || retryNowMs() - db->lastSyncMs >= TSDB_SYNC_MS)
+        return tsdbSync(db);
+
+    return 0;
+}
+
+void tsdbClose(tsdb_t* db)
+{
+    if (db->map == NULL)
+        return;
+
+    tsdbSync(db);
+    munmap(db->map, db->mapSize);
+    ftruncate(db->fd, TSDB_REC_OFF(db->count));
+    close(db->fd);
+
+    db->map = NULL;
+    db->fd = -1;
+}
+
+int tsdbReaderOpen(tsdb_reader_t* r, const char* path)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0)
+        return -1;
+
+    if (fstat(r->fd, &st) < 0)
+        goto fail;
+
+    if (st.st_size < (off_t) sizeof(tsdb_header_t)) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+
+    r->map = map;
+    r->mapSize = st.st_size;
+
+    const tsdb_header_t* hdr = (const tsdb_header_t*) r->map;
+    if (!tsdbHeaderValid(hdr)) {
+        munmap(map, r->mapSize);
+        errno = EINVAL;
+        goto fail;
+    }
+
+    madvise(map, r->mapSize, MADV_SEQUENTIAL);
+    r->count = tsdbScanCount(r->map, r->mapSize, hdr->count);
+    r->records = (const tsdb_record_t*) (r->map + sizeof(tsdb_header_t));
+    /* records after the last sync are not covered by the header flag yet */
+    r->ordered = !(hdr->flags & TSDB_HDR_UNORDERED) && !tsdbUnordered(r->records, hdr->count, r->count);
+    return 0;
+
+fail:
+    close(r->fd);
+    r->fd = -1;
+    r->map = NULL;
+    return -1;
+}
+
+uint64_t tsdbReaderFind(const tsdb_reader_t* r, int64_t timeUs)
+{
+    uint64_t lo = 0, hi = r->count;
+
+    if (!r->ordered) {
+        while (lo < hi && r->records[lo].timeUs < timeUs)
+            lo++;
+        return lo;
+    }
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (r->records[mid].timeUs < timeUs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+void tsdbReaderClose(tsdb_reader_t* r)
+{
+    if (r->map != NULL)
+        munmap((void*) r->map, r->mapSize);
+    if (r->fd >= 0)
+        close(r->fd);
+
+    r->map = NULL;
+    r->fd = -1;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file    tsdb.h
+ * @brief   Append-only binary time-series store of flight samples (mmap based)
+ */
+#ifndef _TSDB_H_
+#define _TSDB_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TSDB_MAGIC              "AQTS"
+#define TSDB_VERSION            1
+#define TSDB_GROW_RECORDS       65536       // file grows by 2 MiB at a time
+#define TSDB_SYNC_RECORDS       60
+#define TSDB_SYNC_MS            5000
+
+/* record flags */
+#define TSDB_FLAG_HOVER         0x01
+
+/* header flags */
+#define TSDB_HDR_UNORDERED      0x01        // a record is older than one before it (clock stepped back)
+
+/* file = header + fixed-size records, native little-endian.
+   Records past header.count are valid up to the first zero timestamp. */
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t flags;             // TSDB_HDR_*
+    uint64_t count;             // records on disk at the last sync
+    int64_t createdUs;
+    uint8_t pad[32];
+} tsdb_header_t;
+
+typedef struct {
+    int64_t timeUs;             // CLOCK_REALTIME, microseconds since epoch
+    int32_t lat;                // degrees * 1e7
+    int32_t lon;                // degrees * 1e7
+    int32_t altMm;              // relative altitude, millimetres
+    uint16_t pm1;               // ug/m3
+    uint16_t pm25;              // ug/m3
+    uint16_t pm10;              // ug/m3
+    uint16_t aqi10;             // AQI * 10
+    uint8_t fixType;            // GPS fix type (MAVLink GPS_FIX_TYPE)
+    uint8_t satellites;
+    uint8_t flags;              // TSDB_FLAG_*
+    uint8_t reserved;
+} tsdb_record_t;
+
+_Static_assert(sizeof(tsdb_header_t) == 64, "tsdb header must be 64 bytes");
+_Static_assert(sizeof(tsdb_record_t) == 32, "tsdb record must be 32 bytes");
+
+/* writer, one thread only */
+typedef struct {
+    int fd;
+    uint8_t* map;
+    size_t mapSize;             // file size, whole file is mapped
+    uint64_t count;
+    uint64_t syncedCount;
+    uint64_t lastSyncMs;
+    int64_t lastTimeUs;         // of the newest record
+    uint32_t flags;             // TSDB_HDR_*, written with the next sync
+} tsdb_t;
+
+/* read-only view of a store, may be open while it is written */
+typedef struct {
+    int fd;
+    const uint8_t* map;
+    size_t mapSize;
+    uint64_t count;
+    bool ordered;               // records are in time order, searched by bisection
+    const tsdb_record_t* records;
+} tsdb_reader_t;
+
+/**
+ * @brief   Open a store for appending, creating it if missing.
+ *          Records written after the last sync are recovered. Disk space
+ *          is reserved before it is mapped, so a full disk fails the call
+ *          instead of raising SIGBUS on a later write.
+ * @param   db Store.
+ * @param   path File path.
+ * @return  0 on success; -1 on error.
+ */
+int tsdbOpen(tsdb_t* db, const char* path);
+
+/**
+ * @brief   Append one record; syncs every TSDB_SYNC_RECORDS records or TSDB_SYNC_MS.
+ *          A record older than the one before it marks the store unordered.
+ * @param   db Store.
+ * @param   rec Record to append.
+ * @return  0 on success; -1 on error.
+ */
+int tsdbAppend(tsdb_t* db, const tsdb_record_t* rec);
+
+/**
+ * @brief   Flush appended records to disk, then the header count.
+ * @param   db Store.
+ * @return  0 on success; -1 on error.
+ */
+int tsdbSync(tsdb_t* db);
+
+/**
+ * @brief   Sync, trim the file to its records and close the store.
+ * @param   db Store.
+ * @return  none.
+ */
+void tsdbClose(tsdb_t* db);
+
+/**
+ * @brief   Map a store read-only.
+ * @param   r Reader.
+ * @param   path File path.
+ * @return  0 on success; -1 on error (errno set).
+ */
+int tsdbReaderOpen(tsdb_reader_t* r, const char* path);
+
+/**
+ * @brief   Find the first record at or after a time: a bisection if the
+ *          records are in time order, a linear scan otherwise.
+ * @param   r Reader.
+ * @param   timeUs Time in microseconds since epoch.
+ * @return  Index of the first record, in file order, with a time at or after
+ *          timeUs; r->count if there is none.
+ */
+uint64_t tsdbReaderFind(const tsdb_reader_t* r, int64_t timeUs);
+
+/**
+ * @brief   Unmap a store.
+ * @param   r Reader.
+ * @return  none.
+ */
+void tsdbReaderClose(tsdb_reader_t* r);
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * @file    blogdump.c
+ * @brief   Rebuild text logs from a binary log file (sys/blog.h) on the host
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "sys/blog.h"
+
+typedef struct {
+    const char* tag;
+    const char* fmt;
+    const char* file;
+    unsigned line;
+} blog_site_t;
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+} blog_cursor_t;
+
+static uint16_t getU16(const uint8_t* p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+    return (uint32_t) getU16(p) | (uint32_t) getU16(p + 2) << 16;
+}
+
+static uint64_t getVarint(blog_cursor_t* c)
+{
+    uint64_t v = 0;
+
+    for (int shift = 0; c->p < c->end && shift < 64; shift += 7) {
+        uint8_t b = *c->p++;
+        v |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+
+    return v;
+}
+
+static int64_t getZigzag(blog_cursor_t* c)
+{
+    uint64_t z = getVarint(c);
+    return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+}
+
+/* spec without length modifiers, with "ll" for integers */
+static void buildSpec(const blog_spec_t* spec, char* out, size_t size)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i + 1 < spec->len && n + 4 < size; i++) {
+        if (!strchr("hlLqjzt", spec->start[i]))
+            out[n++] = spec->start[i];
+    }
+
+    if (spec->kind == BLOG_ARG_INT && spec->conv != 'c') {
+        out[n++] = 'l';
+        out[n++] = 'l';
+    }
+    if (spec->kind == BLOG_ARG_UINT) {
+        out[n++] = 'l';
+        out[n++] = 'l';
+    }
+
+    out[n++] = spec->conv;
+    out[n] = '\0';
+}
+
+#define FORMAT_ARG(out, size, spec, stars, nstars, value) \
+    ((nstars) == 0 ? snprintf(out, size, spec, value) : \
+     (nstars) == 1 ? snprintf(out, size, spec, (stars)[0], value) : \
+                     snprintf(out, size, spec, (stars)[0], (stars)[1], value))
+
+static void formatRecord(const char* fmt, blog_cursor_t* c, char* out, size_t size)
+{
+    size_t n = 0;
+    blog_spec_t spec;
+    const char* p = fmt;
+    const char* next;
+
+    out[0] = '\0';
+    while (n < size - 1 && (next = blogNextSpec(p, &spec)) != NULL) {
+        size_t lit = spec.start - p;
+        if (lit > size - 1 - n)
+            lit = size - 1 - n;
+        memcpy(out + n, p, lit);
+        n += lit;
+        p = next;
+
+        if (c->p >= c->end && spec.kind != BLOG_ARG_NONE) {
+            /* record was cut while packing */
+            n += snprintf(out + n, size - n, "<?>");
+            continue;
+        }
+
+        char sp[32];
+        int stars[2] = {0};
+        int nstars = (spec.stars > 2) ? 2 : spec.stars;
+        for (int i = 0; i < spec.stars; i++) {
+            int v = (int) getZigzag(c);
+            if (i < 2)
+                stars[i] = v;
+        }
+
+        buildSpec(&spec, sp, sizeof(sp));
+        char* o = out + n;
+        size_t room = size - n;
+        int w = 0;
+
+        switch (spec.kind) {
+        case BLOG_ARG_INT: {
+            long long v = getZigzag(c);
+            w = (spec.conv == 'c') ? FORMAT_ARG(o, room, sp, stars, nstars, (int) v)
+                                   : FORMAT_ARG(o, room, sp, stars, nstars, v);
+            break;
+        }
+        case BLOG_ARG_UINT: {
+            unsigned long long v = getVarint(c);
+            w = FORMAT_ARG(o, room, sp, stars, nstars, v);
+            break;
+        }
+        case BLOG_ARG_DOUBLE: {
+            double v = 0;
+            if (c->end - c->p >= (long) sizeof(v))
+                memcpy(&v, c->p, sizeof(v));
+            c->p += sizeof(v);
+            w = FORMAT_ARG(o, room, sp, stars, nstars, v);
+            break;
+        }
+        case BLOG_ARG_STR: {
+            char str[256];
+            size_t len = getVarint(c);
+            if (len > (size_t) (c->end - c->p))
+                len = c->end - c->p;
+            if (len > sizeof(str) - 1)
+                len = sizeof(str) - 1;
+            memcpy(str, c->p, len);
+            str[len] = '\0';
+            c->p += len;
+            w = FORMAT_ARG(o, room, sp, stars, nstars, str);
+            break;
+        }
+        case BLOG_ARG_PTR: {
+            void* v = (void*) (uintptr_t) getVarint(c);
+            w = FORMAT_ARG(o, room, sp, stars, nstars, v);
+            break;
+        }
+        default:
+            w = snprintf(o, room, "%s", (spec.conv == '%') ? "%" : "");
+            break;
+        }
+
+        if (w > 0)
+            n += ((size_t) w < room) ? (size_t) w : room - 1;
+    }
+
+    snprintf(out + n, size - n, "%s", p);
+}
+
+static void printTime(uint64_t startUs, uint32_t ms)
+{
+    uint64_t us = startUs + (uint64_t) ms * 1000;
+    time_t sec = us / 1000000;
+    struct tm tm_info;
+    char buf[24];
+
+    localtime_r(&sec, &tm_info);
+    strftime(buf, sizeof(buf), "%d-%m-%Y %H:%M:%S", &tm_info);
+    printf("[%s.%03u] ", buf, (unsigned) (us / 1000 % 1000));
+}
+
+int main(int argc, char** argv)
+{
+    int listSites = 0;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0)
+            listSites = 1;
+        else
+            path = argv[i];
+    }
+
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-l] file.blog\n  -l  list the call sites of each session\n", argv[0]);
+        return 2;
+    }
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    uint8_t* data = malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t) size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        return 1;
+    }
+    fclose(fp);
+
+    blog_site_t* sites = NULL;
+    unsigned siteCount = 0;
+    uint64_t startUs = 0;
+    long skipped = 0;
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    char text[1024];
+
+    while (p < end) {
+        if (end - p >= 15 && memcmp(p, BLOG_MAGIC, 4) == 0 && p[4] == BLOG_VERSION) {
+            startUs = (uint64_t) getU32(p + 5) | (uint64_t) getU32(p + 9) << 32;
+            siteCount = getU16(p + 13);
+            p += 15;
+
+            free(sites);
+            sites = calloc(siteCount ? siteCount : 1, sizeof(*sites));
+            for (unsigned i = 0; i < siteCount && end - p > 4; i++) {
+                unsigned id = getU16(p);
+                unsigned line = getU16(p + 2);
+                p += 4;
+
+                const char* str[3];
+                for (int k = 0; k < 3; k++) {
+                    str[k] = (const char*) p;
+                    const uint8_t* z = memchr(p, 0, end - p);
+                    p = (z != NULL) ? z + 1 : end;
+                }
+
+                if (id < siteCount)
+                    sites[id] = (blog_site_t) { str[0], str[1], str[2], line };
+                if (listSites)
+                    printf("#%u %s:%u [%s] %s\n", id, str[2], line, str[0], str[1]);
+            }
+            continue;
+        }
+
+        if (*p != BLOG_REC || end - p < BLOG_REC_HDR_LEN || end - p < BLOG_REC_HDR_LEN + p[7]) {
+            /* torn write or foreign bytes: resync on the next record */
+            p++;
+            skipped++;
+            continue;
+        }
+
+        unsigned id = getU16(p + 1);
+        uint32_t ms = getU32(p + 3);
+        blog_cursor_t c = { p + BLOG_REC_HDR_LEN, p + BLOG_REC_HDR_LEN + p[7] };
+        p = c.end;
+
+        if (listSites)
+            continue;
+
+        printTime(startUs, ms);
+        if (id == BLOG_ID_DROPPED) {
+            printf("[WRN] %llu log line(s) dropped\n", (unsigned long long) getVarint(&c));
+        } else if (sites == NULL || id >= siteCount || sites[id].fmt == NULL) {
+            printf("[???] unknown log site #%u\n", id);
+        } else {
+            formatRecord(sites[id].fmt, &c, text, sizeof(text));
+            printf("[%s] %s\n", sites[id].tag, text);
+        }
+    }
+
+    if (skipped > 0)
+        fprintf(stderr, "%ld byte(s) skipped\n", skipped);
+
+    free(sites);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file    json_bench.c
+ * @brief   Microbenchmark: fixed-point formatJsonData() against the old snprintf path
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sys/json.h"
+
+#define JSON_BENCH_DEFAULT_ITER     1000000
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the formatter before the fixed-point rewrite, kept here for comparison */
+static size_t formatJsonSnprintf(char* buf, size_t len, float lat, float lng, float alt, uint32_t pm25, float aqi)
+{
+    int n = snprintf(buf, len,
+        "{\"lat\":%f,"
+        "\"lng\":%f,"
+        "\"alt\":%f,"
+        "\"pm2_5\":%d,"
+        "\"aqi\":%f}",
+        lat, lng, alt, pm25, aqi);
+
+    return (n < 0 || (size_t) n >= len) ? 0 : (size_t) n;
+}
+
+int main(int argc, char** argv)
+{
+    long iter = (argc > 1) ? atol(argv[1]) : JSON_BENCH_DEFAULT_ITER;
+    char buf[JSON_RECORD_MAX_LEN];
+    volatile size_t sink = 0;
+
+    if (iter <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    double lat = 10.7318123, lng = 106.6981456, alt = 52.37;
+
+    formatJsonSnprintf(buf, sizeof(buf), lat, lng, alt, 37, 104.2f);
+    printf("snprintf: %s\n", buf);
+    formatJsonData(buf, sizeof(buf), lat, lng, alt, 37, 104.2f);
+    printf("fixed:    %s\n", buf);
+
+    /* vary the inputs so neither path sees a constant */
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < iter; i++)
+        sink += formatJsonSnprintf(buf, sizeof(buf), lat + i * 1e-7, lng, alt, i & 0x1FF, (i & 0x1FF) * 0.4f);
+    uint64_t t1 = now_ns();
+    for (long i = 0; i < iter; i++)
+        sink += formatJsonData(buf, sizeof(buf), lat + i * 1e-7, lng, alt, i & 0x1FF, (i & 0x1FF) * 0.4f);
+    uint64_t t2 = now_ns();
+
+    double slow = (double) (t1 - t0) / iter;
+    double fast = (double) (t2 - t1) / iter;
+    printf("%ld iterations: snprintf %.1f ns, fixed %.1f ns, %.1fx\n", iter, slow, fast, slow / fast);
+    return 0;
+}
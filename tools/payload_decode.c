@@ -0,0 +1,61 @@
+/**
+ * @file    payload_decode.c
+ * @brief   Decode binary sample payloads (sys/payload.h) into JSON for ingestion.
+ *          Takes plain v1 records as well as delta coded batches.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sys/payload.h"
+
+#define PAYLOAD_DECODE_MAX_LEN      (1024 * 1024)
+
+/* one payload in, one JSON array out with the same keys as the JSON path */
+int main(int argc, char** argv)
+{
+    FILE* fp = stdin;
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "usage: %s [payload-file]   (reads stdin without a file)\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 2 && (fp = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    uint8_t* buf = malloc(PAYLOAD_DECODE_MAX_LEN);
+    if (buf == NULL)
+        return 1;
+
+    size_t len = fread(buf, 1, PAYLOAD_DECODE_MAX_LEN, fp);
+    if (fp != stdin)
+        fclose(fp);
+
+    size_t off = 0;
+    int count = 0;
+    payload_delta_t state;
+    payloadDeltaInit(&state);
+
+    printf("[");
+    while (off < len) {
+        payload_sample_t s;
+        int n = payloadDecodeNext(&state, buf + off, len - off, &s);
+        if (n <= 0) {
+            fprintf(stderr, "%s entry at offset %zu (tag %u)\n",
+                (n < 0) ? "unknown" : "truncated", off, buf[off]);
+            break;
+        }
+
+        printf("%s{\"time\":%u,\"lat\":%.7f,\"lng\":%.7f,\"alt\":%.3f,\"pm2_5\":%u,\"aqi\":%.1f}",
+            (count > 0) ? "," : "", s.time, s.lat, s.lon, s.alt, s.pm25, s.aqi);
+        off += n;
+        count++;
+    }
+    printf("]\n");
+
+    free(buf);
+    return (off == len) ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file    ringbuffer_stress.c
+ * @brief   Two-thread stress test of the SPSC ring buffer: byte stream and record queue
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "sys/ringbuffer.h"
+
+#define RB_STRESS_DEFAULT_BYTES     (16UL * 1024 * 1024)
+#define RB_STRESS_DEFAULT_RECORDS   500000UL
+#define RB_STRESS_BUF_SIZE          256         // small, so that the indexes wrap often
+#define RB_STRESS_RECORD_MAX        120
+
+static ring_buffer_spsc_t rb;
+static char rbMem[RB_STRESS_BUF_SIZE];
+static unsigned long total;
+static unsigned long producerDropped;
+static atomic_bool producerDone;
+
+/* byte i of the stream; 131 is odd, so every value shows up */
+static char streamByte(unsigned long i)
+{
+    return (char) (i * 131 + (i >> 8));
+}
+
+/* record seq: u32 seq, then bytes derived from it, length varies with seq */
+static size_t recordLen(uint32_t seq)
+{
+    return sizeof(seq) + (seq * 7919) % (RB_STRESS_RECORD_MAX - sizeof(seq) + 1);
+}
+
+static void recordFill(char* rec, uint32_t seq)
+{
+    memcpy(rec, &seq, sizeof(seq));
+    for (size_t k = sizeof(seq); k < recordLen(seq); k++)
+        rec[k] = (char) (seq ^ (k * 37));
+}
+
+/* chunks of 1..37 bytes, retried while the buffer is full */
+static void* streamProducer(void* arg)
+{
+    char chunk[37];
+    unsigned long i = 0;
+
+    while (i < total) {
+        size_t n = i % sizeof(chunk) + 1;
+        if (n > total - i)
+            n = total - i;
+
+        for (size_t k = 0; k < n; k++)
+            chunk[k] = streamByte(i + k);
+
+        if (ring_buffer_spsc_queue_arr(&rb, chunk, n) == n)
+            i += n;
+    }
+
+    return arg;
+}
+
+static void* recordProducer(void* arg)
+{
+    char rec[RB_STRESS_RECORD_MAX];
+
+    for (uint32_t seq = 0; seq < total; seq++) {
+        recordFill(rec, seq);
+
+        int dropped = ring_buffer_push_record(&rb, rec, recordLen(seq));
+        if (dropped < 0) {
+            fprintf(stderr, "record %u can never fit\n", seq);
+            exit(1);
+        }
+        producerDropped += dropped;
+    }
+
+    atomic_store(&producerDone, true);
+    return arg;
+}
+
+/* read with varying sizes and check every byte against the stream */
+static int streamConsumer(void)
+{
+    char out[64];
+    unsigned long i = 0;
+
+    while (i < total) {
+        ring_buffer_spsc_wait(&rb, 100);
+        size_t n = ring_buffer_spsc_dequeue_arr(&rb, out, i % 61 + 1);
+
+        for (size_t k = 0; k < n; k++) {
+            if (out[k] != streamByte(i + k)) {
+                printf("stream: byte %lu is 0x%02x, expected 0x%02x\n",
+                       i + k, (uint8_t) out[k], (uint8_t) streamByte(i + k));
+                return -1;
+            }
+        }
+        i += n;
+    }
+
+    return 0;
+}
+
+/* whole records in order; the gaps must add up to what the producer dropped */
+static int recordConsumer(unsigned long* received, unsigned long* gaps)
+{
+    char out[RB_STRESS_RECORD_MAX];
+    char want[RB_STRESS_RECORD_MAX];
+    long last = -1;
+    bool done = false;
+
+    *received = 0;
+    *gaps = 0;
+
+    while (1) {
+        size_t n = ring_buffer_pop_record(&rb, out, sizeof(out));
+        if (n == 0) {
+            /* empty after the producer finished: everything was seen */
+            if (done)
+                break;
+            done = atomic_load(&producerDone);
+            if (!done)
+                ring_buffer_spsc_wait(&rb, 10);
+            continue;
+        }
+
+        uint32_t seq;
+        memcpy(&seq, out, sizeof(seq));
+        if ((long) seq <= last || seq >= total) {
+            printf("records: seq %u after %ld\n", seq, last);
+            return -1;
+        }
+
+        recordFill(want, seq);
+        if (n != recordLen(seq) || memcmp(out, want, n) != 0) {
+            printf("records: seq %u corrupt (%u bytes, expected %u)\n", seq, (unsigned) n, (unsigned) recordLen(seq));
+            return -1;
+        }
+
+        *gaps += seq - last - 1;
+        last = seq;
+        (*received)++;
+    }
+
+    *gaps += total - 1 - last;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long bytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : RB_STRESS_DEFAULT_BYTES;
+    unsigned long records = (argc > 2) ? strtoul(argv[2], NULL, 0) : RB_STRESS_DEFAULT_RECORDS;
+    pthread_t tid;
+
+    if (bytes == 0 || records == 0 || records > UINT32_MAX) {
+        fprintf(stderr, "usage: %s [bytes] [records]\n", argv[0]);
+        return 2;
+    }
+
+    if (ring_buffer_spsc_init(&rb, rbMem, sizeof(rbMem)) < 0) {
+        fprintf(stderr, "ring buffer init failed\n");
+        return 1;
+    }
+
+    total = bytes;
+    pthread_create(&tid, NULL, streamProducer, NULL);
+    int err = streamConsumer();
+    pthread_join(tid, NULL);
+    if (err < 0)
+        return 1;
+    printf("stream:  %lu bytes through a %d byte ring, all intact\n", bytes, RB_STRESS_BUF_SIZE);
+
+    unsigned long received, gaps;
+    close(rb.event_fd);
+    ring_buffer_spsc_init(&rb, rbMem, sizeof(rbMem));
+    total = records;
+    producerDropped = 0;
+    pthread_create(&tid, NULL, recordProducer, NULL);
+    err = recordConsumer(&received, &gaps);
+    pthread_join(tid, NULL);
+    if (err < 0)
+        return 1;
+
+    printf("records: %lu pushed, %lu received intact, %lu dropped by the producer, %lu missing\n",
+           records, received, producerDropped, gaps);
+    if (gaps != producerDropped) {
+        printf("records: %lu lost without being reported\n", gaps - producerDropped);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
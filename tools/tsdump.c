@@ -0,0 +1,121 @@
+/**
+ * @file    tsdump.c
+ * @brief   Dump or summarize a flight time-series store (sys/tsdb.h) on the host
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include "sys/tsdb.h"
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "usage: %s [-f from] [-t to] [-n max] [-s] [-H] file\n"
+        "  -f from   first time, unix seconds\n"
+        "  -t to     end time (exclusive), unix seconds\n"
+        "  -n max    print at most max records\n"
+        "  -s        print a summary instead of records\n"
+        "  -H        only print records taken while hovering\n",
+        prog);
+}
+
+static void printRecord(const tsdb_record_t* rec)
+{
+    printf("%lld.%06lld,%.7f,%.7f,%.3f,%u,%u,%u,%.1f,%u,%u,%u\n",
+        (long long) (rec->timeUs / 1000000), (long long) (rec->timeUs % 1000000),
+        rec->lat / 1e7, rec->lon / 1e7, rec->altMm / 1000.0,
+        rec->pm1, rec->pm25, rec->pm10, rec->aqi10 / 10.0,
+        rec->fixType, rec->satellites, rec->flags);
+}
+
+int main(int argc, char** argv)
+{
+    int64_t fromUs = INT64_MIN, toUs = INT64_MAX;
+    uint64_t max = UINT64_MAX;
+    int summary = 0, hoverOnly = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:n:sH")) != -1) {
+        switch (opt) {
+        case 'f': fromUs = (int64_t) (strtod(optarg, NULL) * 1e6); break;
+        case 't': toUs = (int64_t) (strtod(optarg, NULL) * 1e6); break;
+        case 'n': max = strtoull(optarg, NULL, 10); break;
+        case 's': summary = 1; break;
+        case 'H': hoverOnly = 1; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    tsdb_reader_t r;
+    if (tsdbReaderOpen(&r, argv[optind]) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    uint64_t i = (fromUs == INT64_MIN) ? 0 : tsdbReaderFind(&r, fromUs);
+    uint64_t n = 0, hover = 0, fixed = 0;
+    uint64_t pm25Sum = 0;
+    uint16_t pm25Min = UINT16_MAX, pm25Max = 0;
+    int64_t firstUs = 0, lastUs = 0;
+
+    if (!summary)
+        printf("time,lat,lon,alt,pm1,pm2_5,pm10,aqi,fix,sats,flags\n");
+
+    for (; i < r.count && n < max; i++) {
+        const tsdb_record_t* rec = &r.records[i];
+        /* after a clock step a later record may fall back into the range */
+        if (rec->timeUs >= toUs) {
+            if (r.ordered)
+                break;
+            continue;
+        }
+        if (rec->timeUs < fromUs)
+            continue;
+        if (hoverOnly && !(rec->flags & TSDB_FLAG_HOVER))
+            continue;
+
+        if (n == 0)
+            firstUs = rec->timeUs;
+        lastUs = rec->timeUs;
+        n++;
+
+        if (!summary) {
+            printRecord(rec);
+            continue;
+        }
+
+        pm25Sum += rec->pm25;
+        if (rec->pm25 < pm25Min)
+            pm25Min = rec->pm25;
+        if (rec->pm25 > pm25Max)
+            pm25Max = rec->pm25;
+        if (rec->flags & TSDB_FLAG_HOVER)
+            hover++;
+        if (rec->fixType >= 2)
+            fixed++;
+    }
+
+    if (summary) {
+        printf("records:  %llu of %llu%s\n", (unsigned long long) n, (unsigned long long) r.count,
+               r.ordered ? "" : " (not in time order: clock stepped back)");
+        if (n > 0) {
+            printf("span:     %lld.%06lld .. %lld.%06lld (%.1f s)\n",
+                (long long) (firstUs / 1000000), (long long) (firstUs % 1000000),
+                (long long) (lastUs / 1000000), (long long) (lastUs % 1000000),
+                (lastUs - firstUs) / 1e6);
+            printf("pm2_5:    min %u  max %u  mean %.1f\n", pm25Min, pm25Max, (double) pm25Sum / n);
+            printf("hovering: %llu\n", (unsigned long long) hover);
+            printf("gps fix:  %llu\n", (unsigned long long) fixed);
+        }
+    }
+
+    tsdbReaderClose(&r);
+    return 0;
+}